@@ -0,0 +1,75 @@
+#include "buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <random>
+
+#define BENCH_TABLE     ((char*)"DATA9999")
+#define BENCH_LOG       ((char*)"bench_log.data")
+#define MIN_FRAMES      (1000)
+#define MAX_FRAMES      (1000000)
+#define NUM_HITS        (1000000)
+
+/*
+ * Hit-path microbenchmark.
+ * For each pool size, every frame is filled with a distinct page and then
+ * NUM_HITS random buffer_read_page/buffer_unpin_page pairs are timed. All
+ * requests hit, so the reported cost is the page table lookup plus the
+ * replacement bookkeeping, which should not grow with the pool size.
+ *
+ * usage: buffer_bench [max_frames]
+ */
+
+static double elapsed_ns(struct timespec* begin, struct timespec* end) {
+    return (end->tv_sec - begin->tv_sec) * 1e9 + (end->tv_nsec - begin->tv_nsec);
+}
+
+int main(int argc, char** argv) {
+    int max_frames = argc > 1 ? atoi(argv[1]) : MAX_FRAMES;
+    std::mt19937 gen(0);
+    page_t* page;
+    struct timespec begin, end;
+
+    unlink(BENCH_TABLE);
+    unlink(BENCH_LOG);
+    // write-back forces the log, so the buffer needs one even if nothing is logged
+    init_log(BENCH_LOG);
+    int64_t table_id = file_open_table_file(BENCH_TABLE);
+    // sparse file large enough for every frame to hold a distinct page
+    if (truncate(BENCH_TABLE, (off_t)(max_frames + 1) * PAGE_SIZE) != 0)
+        ERR_SYS("Failure to prepare bench table(truncate error)");
+
+    printf("%10s %14s %14s\n", "frames", "fill(ns/op)", "hit(ns/op)");
+    for (int num_frames = MIN_FRAMES; num_frames <= max_frames; num_frames *= 10) {
+        init_buffer(num_frames);
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (pagenum_t i = 1; i <= (pagenum_t)num_frames; i++) {
+            buffer_read_page(table_id, i, &page);
+            buffer_unpin_page(table_id, i);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double fill = elapsed_ns(&begin, &end) / num_frames;
+
+        std::uniform_int_distribution<pagenum_t> dis(1, num_frames);
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (int i = 0; i < NUM_HITS; i++) {
+            pagenum_t page_num = dis(gen);
+            buffer_read_page(table_id, page_num, &page);
+            buffer_unpin_page(table_id, page_num);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double hit = elapsed_ns(&begin, &end) / NUM_HITS;
+
+        printf("%10d %14.1f %14.1f\n", num_frames, fill, hit);
+        shutdown_buffer();
+    }
+
+    file_close_table_file();
+    shutdown_log();
+    unlink(BENCH_TABLE);
+    unlink(BENCH_LOG);
+    return 0;
+}
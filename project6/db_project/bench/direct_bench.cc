@@ -0,0 +1,126 @@
+#include "buffer.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <random>
+
+#define BENCH_TABLE     ((char*)"DATA9998")
+#define BENCH_LOG       ((char*)"bench_log.data")
+#define NUM_PAGES       (32768)     // 128 MiB table
+#define NUM_FRAMES      (8192)      // 32 MiB buffer
+#define NUM_READS       (100000)
+
+/*
+ * Buffered against direct page I/O.
+ * A table of NUM_PAGES pages is read at random through a buffer of
+ * NUM_FRAMES frames, once with the table file in the page cache as usual and
+ * once opened with O_DIRECT. The file is dropped from the page cache before
+ * each run. Reported are the reads per second, the resident memory of the
+ * process, which holds the buffer, and the part of the table left in the
+ * page cache, which buffered mode adds on top of it.
+ *
+ * usage: direct_bench [num_pages] [num_frames] [num_reads]
+ */
+
+static double elapsed_s(struct timespec* begin, struct timespec* end) {
+    return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+// Resident set of the process in MiB.
+static double rss_mib() {
+    long size, resident;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL || fscanf(fp, "%ld %ld", &size, &resident) != 2)
+        ERR_SYS("Failure to read memory usage(statm error)");
+    fclose(fp);
+    return (double)resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+// Part of the table file in the page cache in MiB.
+static double cached_mib(int num_pages) {
+    int fd = open(BENCH_TABLE, O_RDONLY);
+    size_t len = (size_t)num_pages * PAGE_SIZE;
+    void* addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (fd < 0 || addr == MAP_FAILED)
+        ERR_SYS("Failure to read page cache usage(mmap error)");
+    size_t sys_page = sysconf(_SC_PAGESIZE);
+    unsigned char* vec = new unsigned char[(len + sys_page - 1) / sys_page];
+    if (mincore(addr, len, vec) != 0)
+        ERR_SYS("Failure to read page cache usage(mincore error)");
+    size_t cached = 0;
+    for (size_t i = 0; i < (len + sys_page - 1) / sys_page; i++) {
+        cached += vec[i] & 1;
+    }
+    delete[] vec;
+    munmap(addr, len);
+    close(fd);
+    return (double)cached * sys_page / (1024 * 1024);
+}
+
+static void drop_cache() {
+    int fd = open(BENCH_TABLE, O_RDONLY);
+    if (fd < 0)
+        ERR_SYS("Failure to drop page cache(open error)");
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+int main(int argc, char** argv) {
+    int num_pages = argc > 1 ? atoi(argv[1]) : NUM_PAGES;
+    int num_frames = argc > 2 ? atoi(argv[2]) : NUM_FRAMES;
+    int num_reads = argc > 3 ? atoi(argv[3]) : NUM_READS;
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<pagenum_t> dis(1, num_pages - 1);
+    struct timespec begin, end;
+    page_t* page;
+
+    unlink(BENCH_TABLE);
+    unlink(BENCH_LOG);
+    // written out, not sparse, so that reads reach the device
+    int fd = open(BENCH_TABLE, O_RDWR | O_CREAT, 0644);
+    char* chunk = (char*)calloc(FILE_IO_BATCH, PAGE_SIZE);
+    for (int i = 0; i < num_pages; i += FILE_IO_BATCH) {
+        for (int j = 0; j < FILE_IO_BATCH; j++) {
+            ((page_t*)chunk)[j].num_pages = i == 0 && j == 0 ? num_pages : 0;
+            ((page_t*)chunk)[j].magic = i == 0 && j == 0 ? FILE_MAGIC : 0;
+        }
+        if (pwrite(fd, chunk, (size_t)FILE_IO_BATCH * PAGE_SIZE, (off_t)i * PAGE_SIZE) < 0)
+            ERR_SYS("Failure to prepare bench table(write error)");
+    }
+    free(chunk);
+    close(fd);
+
+    printf("%8s %12s %12s %12s %12s\n", "mode", "reads/s", "rss(MiB)", "cache(MiB)", "total(MiB)");
+    for (int direct = 0; direct <= 1; direct++) {
+        drop_cache();
+        file_set_direct_io(direct);
+        init_log(BENCH_LOG);
+        int64_t table_id = file_open_table_file(BENCH_TABLE);
+        init_buffer(num_frames);
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (int i = 0; i < num_reads; i++) {
+            pagenum_t page_num = dis(gen);
+            buffer_read_page(table_id, page_num, &page, SHARED);
+            buffer_unpin_page(table_id, page_num);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double rss = rss_mib(), cached = cached_mib(num_pages);
+        printf("%8s %12.0f %12.1f %12.1f %12.1f\n", direct ? "direct" : "buffered",
+               num_reads / elapsed_s(&begin, &end), rss, cached, rss + cached);
+        shutdown_buffer();
+        file_close_table_file();
+        shutdown_log();
+        unlink(BENCH_LOG);
+    }
+
+    unlink(BENCH_TABLE);
+    return 0;
+}
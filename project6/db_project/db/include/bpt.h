@@ -11,10 +11,15 @@
 #define SLOT_SIZE       16
 #define ENTRY_ORDER     249
 #define THRESHOLD       2500
+#define FIND_RETRIES    4       // optimistic descents before latching
 
-int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path);
+#define WARMUP_PATH     "buffer_warmup.data"    // default resident page list
+
+int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path,
+            int policy = LRU_POLICY, int num_part = BUFFER_PARTS, int swizzle = 0,
+            int direct = 0, const char* warmup = WARMUP_PATH);
 int shutdown_db();
-int64_t open_table(char* pathname);
+int64_t open_table(char* pathname, int read_only = 0);
 
 // SEARCH & UPDATE
 
@@ -22,7 +27,10 @@ int db_find(int64_t table_id, int64_t key,
             char* ret_val, uint16_t* val_size, int trx_id);
 int db_update(int64_t table_id, int64_t key,
               char* value, uint16_t new_val_size, uint16_t* old_val_size, int trx_id);
+int find_leaf_optimistic(int64_t table_id, int64_t key, pagenum_t* leaf_pgnum);
 pagenum_t find_leaf(int64_t table_id, int64_t key);
+int db_scan(int64_t table_id, int64_t begin_key,
+            int (*visit)(int64_t key, char* value, uint16_t size, void* arg), void* arg);
 
 // INSERTION
 
@@ -40,8 +48,8 @@ void insert_into_page_split(int64_t table_id, pagenum_t parent_pgnum,
 void start_tree(int64_t table_id, int64_t key, char* value, uint16_t val_size);
 void insert_into_new_root(int64_t table_id,
                           pagenum_t left_pgnum, int64_t key, pagenum_t right_pgnum);
-pagenum_t make_leaf(int64_t table_id);
-pagenum_t make_page(int64_t table_id);
+pagenum_t make_leaf(int64_t table_id, pagenum_t near);
+pagenum_t make_page(int64_t table_id, pagenum_t near);
 int get_left_index(int64_t table_id, pagenum_t parent_pgnum, pagenum_t left_pgnum);
 
 // DELETION
@@ -2,33 +2,170 @@
 #define DB_BUFFER_H
 
 #include <pthread.h>
+#include <stdio.h>
+#include <atomic>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 #include "file.h"
 #include "log.h"
+#include "replace.h"
 
+#define SHARED      0
+#define EXCLUSIVE   1
+// OR-ed into the mode of a read that is part of a sequential scan
+#define SEQUENTIAL  2
+// hint to buffer_unpin_page() for pages worth keeping resident
+#define PRIORITY    4
+
+#define BUFFER_PARTS            16
+#define BUFFER_PART_MIN_FRAMES  128
+#define BUFFER_PART_MIN_SIZE    16  // smallest partition after a resize
+#define BUFFER_MAX_FRAMES       (1 << 20)   // address space reserved for growth
+#define BUFFER_RESIZE_WAIT_US   1000
+#define BUFFER_ARENA_ALIGN      (2 * 1024 * 1024)
+#define BUFFER_RING_SIZE        64
+#define BUFFER_PREFETCH_THREADS 4
+#define BUFFER_PREFETCH_SHARE   4   // at most 1/4 of a partition pending
+#define BUFFER_WARMUP_BATCH     256
+#define BUFFER_PRIORITY_SHARE   8   // default: keep up to 1/8 of a partition
+#define BUFFER_SWIP_SLOTS       (1 + 248)   // left_child and entries of an inner page
+#define BUFFER_PEEK_HINTS       4096        // frame hints for optimistic reads
+#define BUFFER_MAX_AFFINITIES   64          // tables bound to a NUMA node
+
+#define BUFFER_ALL_TABLES       (-1)
+#define BUFFER_WAIT_BUCKETS     20  // bucket i: waits of [2^i, 2^(i+1)) us
+
+// background cleaner: wake-up period and frames examined per partition
+#define BUFFER_CLEANER_INTERVAL_MS  100
+#define BUFFER_CLEANER_DEPTH        32
+#define BUFFER_CLEANER_SHARE        4   // at most 1/4 of a partition pinned
+// period of the checkpoints taken by the cleaner once the database is open
+#define BUFFER_CHECKPOINT_INTERVAL_MS   30000
+
+// frame metadata, the frame itself lives in the buffer arena
 struct buffer_t {
-    page_t frame;
+    page_t* frame;
     int64_t table_id;
     pagenum_t page_num;
     uint16_t is_dirty;
-    pthread_mutex_t page_latch;
-    buffer_t* prev_LRU;
-    buffer_t* next_LRU;
+    uint16_t in_ring;
+    uint16_t priority;      // kept out of the replacer through PRIORITY
+    uint16_t io_pending;    // prefetch read not completed yet
+    // page_LSN when the frame last became dirty, never above the LSN of the
+    // first logged change it holds that is not on disk
+    uint64_t rec_LSN;
+    std::atomic<int> pin_count;
+    // odd while the frame is latched EXCLUSIVE, read into or taken from its
+    // page, so that optimistic readers can tell it changed
+    std::atomic<uint64_t> version;
+    // swizzling: the frame whose swip refers to this one, the slot of that
+    // swip, swips held by this frame and whether a swip was followed since
+    // the frame was last passed over for eviction
+    std::atomic<int> swip_parent;
+    int swip_slot;
+    std::atomic<int> swip_count;
+    std::atomic<char> swip_ref;
+    // whether a frame kept through PRIORITY was used since demotion last
+    // passed over it
+    std::atomic<char> priority_ref;
+    pthread_rwlock_t page_latch;
+};
+
+// entry of a saved resident page list
+struct buffer_resident_t {
+    int64_t table_id;
+    pagenum_t page_num;
+};
+
+/*
+ * Buffer counters, global or for one table. Latch waits are only timed when
+ * the latch is contended and are kept for the whole buffer.
+ */
+struct buffer_stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t fg_flushes;
+    uint64_t bg_flushes;
+    uint64_t prefetches;
+    // requests from a thread on the partition's node or on another one,
+    // only counted with more than one node
+    uint64_t local;
+    uint64_t remote;
+    uint64_t swip_hits;     // hits through a swip, kept for the whole buffer
+    uint64_t part_waits[BUFFER_WAIT_BUCKETS];
+    uint64_t page_waits[BUFFER_WAIT_BUCKETS];
+};
+
+struct buffer_part_t {
+    pthread_mutex_t part_latch;
+    pthread_cond_t io_cond;
+    std::unordered_map<std::pair<int64_t, pagenum_t>, int, pair_hash> page_table;
+    replacer_t* replacer;
+    int node;               // NUMA node holding the frames
+    int base;
+    int size;
+    int used;
+    int pending;            // frames with a prefetch read in flight
+    std::vector<int> ring;  // frames recycled by sequential reads
+    int ring_size;
+    int ring_next;
+    std::vector<int> priority;  // frames kept resident through PRIORITY
+    int priority_size;
+    int priority_hand;      // next kept frame considered for demotion
+    std::set<std::pair<uint64_t, int>> flush_list;  // dirty frames by rec_LSN
+    // counters are sharded by partition and updated under its latch,
+    // except page latch waits which are timed outside of it; those of a
+    // table are kept by its file slot
+    buffer_stats_t stats;
+    buffer_stats_t table_stats[FILE_MAX_TABLES];
+    std::atomic<uint64_t> page_waits[BUFFER_WAIT_BUCKETS];
 };
 
-int init_buffer(int num_buf);
+int init_buffer(int num_buf, int policy = LRU_POLICY, int num_part = BUFFER_PARTS,
+                int swizzle = 0);
 int shutdown_buffer();
+int buffer_resize(int num_buf);
+void buffer_set_priority_budget(int num_frames);
+int buffer_set_table_node(int64_t table_id, int node);
+int buffer_save_resident(const char* path);
+int buffer_load_resident(const char* path);
+void buffer_warm_table(int64_t table_id);
+void buffer_set_resident_dump(const char* path, int interval_ms);
 
-int buffer_get_first_LRU_idx();
-int buffer_get_last_LRU_idx();
+buffer_part_t* buffer_get_part(int64_t table_id, pagenum_t page_num);
+int buffer_try_evict(void* arg, int idx);
 int buffer_get_buffer_idx(int64_t table_id, pagenum_t page_num);
-int buffer_request_page(int64_t table_id, pagenum_t page_num);
+void buffer_latch_page(buffer_t* buffer, int mode);
+int buffer_request_page(int64_t table_id, pagenum_t page_num, int mode);
 
-pagenum_t buffer_alloc_page(int64_t table_id);
+int buffer_prefetch_pages(int64_t table_id, pagenum_t* page_nums, int n);
+pagenum_t buffer_alloc_pages(int64_t table_id, pagenum_t near, int n);
+pagenum_t buffer_alloc_page(int64_t table_id, pagenum_t near = 0);
 void buffer_free_page(int64_t table_id, pagenum_t page_num);
-void buffer_read_page(int64_t table_id, pagenum_t page_num, page_t** dest);
+void buffer_read_page(int64_t table_id, pagenum_t page_num, page_t** dest,
+                      int mode = EXCLUSIVE);
 void buffer_write_page(int64_t table_id, pagenum_t page_num);
-void buffer_unpin_page(int64_t table_id, pagenum_t page_num);
+void buffer_unpin_page(int64_t table_id, pagenum_t page_num, int hint = 0);
+void buffer_unpin_frame(page_t* page, int hint = 0);
+void buffer_read_child(int64_t table_id, page_t** page, int slot, pagenum_t page_num,
+                       int mode, int hint = 0);
+int buffer_peek_page(int64_t table_id, pagenum_t page_num, page_t** dest, uint64_t* version);
+int buffer_peek_child(int64_t table_id, page_t* parent, uint64_t parent_version, int slot,
+                      pagenum_t page_num, page_t** dest, uint64_t* version);
+int buffer_validate(page_t* page, uint64_t version);
+void buffer_pin_page(int64_t table_id, pagenum_t page_num);
+void buffer_drop_pin(int64_t table_id, pagenum_t page_num);
 void buffer_flush();
+uint64_t buffer_get_min_rec_LSN();
+uint64_t buffer_checkpoint();
+void buffer_set_checkpoint(int interval_ms);
+int buffer_get_stats(int64_t table_id, buffer_stats_t* dest);
+void buffer_dump_stats(FILE* fp);
+void buffer_set_stats_dump(FILE* fp, int interval_ms);
+void buffer_get_hit_stats(uint64_t* hits, uint64_t* misses);
+void buffer_get_flush_stats(uint64_t* fg, uint64_t* bg);
 
 #endif
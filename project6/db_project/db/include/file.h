@@ -3,10 +3,20 @@
 
 #include <stdint.h>
 
+#include <functional>
+#include <utility>
+
 #define PAGE_SIZE           (4 * 1024)
 #define INITIAL_FILESIZE    (10 * 1024 * 1024)
 #define INITIAL_PAGENUM     (INITIAL_FILESIZE / PAGE_SIZE)
 #define NUM_BUCKETS         31
+#define FILE_IO_BATCH       64  // most pages moved by one vectored call
+#define FILE_ALL_TABLES     (-1)
+#define FILE_MAX_TABLES     20
+#define FILE_URING_DEPTH    64  // io_uring entries per thread
+#define FILE_BITMAP_WORDS   496
+#define FILE_BITMAP_BITS    (FILE_BITMAP_WORDS * 64)    // pages per bitmap page
+#define FILE_MAGIC          0x50414d5449424244ULL       // "DBBITMAP"
 
 #ifndef ERR_SYS
 #define ERR_SYS(s) ({ perror((s)); exit(1); })
@@ -40,7 +50,8 @@ struct page_t {
     };
     pagenum_t root_num;
     uint64_t page_LSN;
-    char reserved[80];
+    uint64_t magic;         // header: FILE_MAGIC
+    char reserved[72];
     uint64_t free_space;
     union {
         pagenum_t sibling;
@@ -51,6 +62,7 @@ struct page_t {
             slot_t slots[64];
             char values[3968];
         };
+        uint64_t bitmap[FILE_BITMAP_WORDS];
         entry_t entries[248];
     };
 };
@@ -60,11 +72,36 @@ struct table_t {
     int fd;
 };
 
+// a page to read or write as part of a batch given to file_submit_io()
+struct file_io_t {
+    int64_t table_id;
+    pagenum_t page_num;
+    page_t* page;
+    int write;
+};
+
+struct pair_hash {
+    std::size_t operator()(const std::pair<int64_t, pagenum_t>& pair) const {
+        return std::hash<int64_t>()(pair.first) ^ std::hash<pagenum_t>()(pair.second);
+    }
+};
+
 int64_t file_open_table_file(const char* pathname);
-pagenum_t file_alloc_page(int64_t table_id);
-void file_free_page(int64_t table_id, pagenum_t page_num);
+int64_t file_map_table_file(const char* pathname);
+int file_get_slot(int64_t table_id);
+int64_t file_get_slot_table(int slot);
+page_t* file_map_page(int64_t table_id, pagenum_t page_num);
+void file_advise_page(int64_t table_id, pagenum_t page_num);
+pagenum_t file_alloc_run(int64_t table_id, page_t* header, pagenum_t near, int n,
+                         const std::function<page_t*(pagenum_t)>& get_bitmap,
+                         const std::function<void(pagenum_t, int)>& put_bitmap);
+pagenum_t file_bitmap_page(pagenum_t page_num);
+void file_bitmap_mark(page_t* bitmap, pagenum_t page_num, int n, int used);
 void file_read_page(int64_t table_id, pagenum_t page_num, page_t* dest);
 void file_write_page(int64_t table_id, pagenum_t page_num, const page_t* src);
+void file_sync_table(int64_t table_id);
+void file_submit_io(file_io_t* ios, int n);
+void file_set_direct_io(int direct);
 void file_close_table_file();
 
 #endif
@@ -8,6 +8,7 @@
 #define COMMIT      2
 #define ROLLBACK    3
 #define COMPENSATE  4
+#define CHECKPOINT  5   // header only, prev_LSN is where redo starts
 
 #define old_image(log)        ((log)->trailer)
 #define new_image(log)        ((log)->trailer + (log)->size)
@@ -52,5 +53,7 @@ uint64_t log_write_log(uint64_t prev_LSN, int trx_id, int type,
                        char* old_image, char* new_image, uint64_t next_undo_LSN = 0);
 void log_consider_force(uint32_t log_size);
 void log_force();
+uint64_t log_get_durable_LSN();
+uint64_t log_get_LSN();
 
 #endif
\ No newline at end of file
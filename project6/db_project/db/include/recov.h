@@ -7,9 +7,12 @@
 #include "trx.h"
 #include "log.h"
 
+#define REDO_PREFETCH_DEPTH 64
+
 void recovery(int flag, int log_num, char* logmsg_path);
 void anls_pass(FILE* fp);
 int redo_pass(FILE* fp, int log_num);
+uint64_t redo_prefetch(uint64_t ahead_LSN);
 int undo_pass(FILE* fp, int log_num);
 
 #endif
\ No newline at end of file
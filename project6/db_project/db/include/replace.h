@@ -0,0 +1,43 @@
+#ifndef DB_REPLACE_H_
+#define DB_REPLACE_H_
+
+#include <stdint.h>
+
+#include "file.h"
+
+#define LRU_POLICY      0
+#define CLOCK_POLICY    1
+#define TWO_Q_POLICY    2
+#define LRU_K_POLICY    3
+
+#define LRU_K           2
+#define LRU_K_RETAINED(n)   ((n) > 0 ? (n) : 1)   // histories kept for evicted pages
+#define TWO_Q_KIN(n)    ((n) / 4 > 0 ? (n) / 4 : 1)
+#define TWO_Q_KOUT(n)   ((n) / 2 > 0 ? (n) / 2 : 1)
+
+/*
+ * Replacement policy of the buffer pool.
+ * Frames are identified by their index. insert() is called when a frame is
+ * loaded with a new page, touch() on every hit and remove() when a frame is
+ * dropped. victim() walks the frames in eviction order and returns the first
+ * one accepted by `evictable(arg, idx)`, which also claims it, or -1 when
+ * every frame is in use. The victim keeps its place until it is inserted
+ * again with the new page, so a victim that could not be evicted yet (e.g.
+ * a dirty frame written back first) is offered again on the next call.
+ * candidates() lists up to `n` frames from the eviction end without claiming
+ * them, for write-back ahead of demand. resize() changes the number of
+ * frames; frames beyond a smaller size must have been removed first.
+ */
+struct replacer_t {
+    virtual ~replacer_t() {}
+    virtual void insert(int idx, int64_t table_id, pagenum_t page_num) = 0;
+    virtual void touch(int idx) = 0;
+    virtual void remove(int idx) = 0;
+    virtual int victim(int (*evictable)(void* arg, int idx), void* arg) = 0;
+    virtual int candidates(int* dest, int n) = 0;
+    virtual void resize(int num_frames) = 0;
+};
+
+replacer_t* replacer_create(int policy, int num_frames);
+
+#endif
@@ -6,9 +6,6 @@
 #include "buffer.h"
 #include "log.h"
 
-#define SHARED      0
-#define EXCLUSIVE   1
-
 #define INIT_BIT(n)     (1UL << (n))
 #define GET_BIT(m, n)   (((m) >> (n)) & 1U)
 #define SET_BIT(m, n)   ({ (m) |= (1UL << (n)); })
@@ -35,12 +32,6 @@ struct trx_entry_t {
     uint64_t last_LSN;
 };
 
-struct pair_hash {
-    std::size_t operator()(const std::pair<int64_t, pagenum_t>& pair) const {
-        return std::hash<int64_t>()(pair.first) ^ std::hash<pagenum_t>()(pair.second);
-    }
-};
-
 int init_lock_table();
 int shutdown_lock_table();
 
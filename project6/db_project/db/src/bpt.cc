@@ -2,24 +2,50 @@
 
 #include <string.h>
 
-int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path) {
+static const char* warmup_path;
+
+/*
+ * The resident pages are saved to `warmup` by shutdown_db() and prefetched
+ * from it as their tables are opened, unless it is NULL. The path is kept
+ * until shutdown_db().
+ */
+int init_db(int num_buf, int flag, int log_num, char* log_path, char* logmsg_path,
+            int policy, int num_part, int swizzle, int direct, const char* warmup) {
+    file_set_direct_io(direct);
     if (init_log(log_path) != 0) return -1;
-    if (init_buffer(num_buf) != 0) return -1;
+    if (init_buffer(num_buf, policy, num_part, swizzle) != 0) return -1;
     if (init_lock_table() != 0) return -1;
     recovery(flag, log_num, logmsg_path);
+    buffer_set_checkpoint(BUFFER_CHECKPOINT_INTERVAL_MS);
+    warmup_path = warmup;
+    if (warmup_path != NULL)
+        buffer_load_resident(warmup_path);
     return 0;
 }
 
 int shutdown_db() {
     if (shutdown_lock_table() != 0) return -1;
+    if (warmup_path != NULL)
+        buffer_save_resident(warmup_path);
     if (shutdown_buffer() != 0) return -1;
     if (shutdown_log() != 0) return -1;
     file_close_table_file();
     return 0;
 }
 
-int64_t open_table(char* pathname) {
-    return file_open_table_file(pathname);
+/*
+ * With `read_only`, the table is mapped instead of read through the buffer,
+ * for readers of a table no one writes; db_insert(), db_delete() and
+ * db_update() then fail on it. Returns -1 for a table file in the format
+ * from before bitmap pages.
+ */
+int64_t open_table(char* pathname, int read_only) {
+    if (read_only)
+        return file_map_table_file(pathname);
+    int64_t table_id = file_open_table_file(pathname);
+    if (table_id < 0) return -1;
+    buffer_warm_table(table_id);
+    return table_id;
 }
 
 // SEARCH & UPDATE
@@ -34,7 +60,7 @@ int db_find(int64_t table_id, int64_t key,
     p_pgnum = find_leaf(table_id, key);
     if (p_pgnum == 0) return -1;
 
-    buffer_read_page(table_id, p_pgnum, &p);
+    buffer_read_page(table_id, p_pgnum, &p, SHARED);
     int i;
     int num_keys = p->num_keys;
     for (i = 0; i < num_keys; i++) {
@@ -66,6 +92,7 @@ int db_update(int64_t table_id, int64_t key,
     page_t* p;
 
     if (!trx_is_active(trx_id)) return trx_id;
+    if (file_map_page(table_id, 0) != NULL) return -1;
 
     p_pgnum = find_leaf(table_id, key);
     if (p_pgnum == 0) return -1;
@@ -101,14 +128,79 @@ int db_update(int64_t table_id, int64_t key,
     return 0;
 }
 
-pagenum_t find_leaf(int64_t table_id, int64_t key) {
+/*
+ * Descends to the leaf for `key` without pinning or latching any page, each
+ * node read being validated against the version of its frame before its
+ * child is followed. With swizzling, children are followed through swips,
+ * which are set along the way (pinning the two frames just for that).
+ * Returns 0 with the leaf in `leaf_pgnum`, 1 if a page changed during the
+ * descent, or -1 if a page on the path is not resident, with that page in
+ * `leaf_pgnum` (0 for the header page).
+ */
+int find_leaf_optimistic(int64_t table_id, int64_t key, pagenum_t* leaf_pgnum) {
     pagenum_t p_pgnum, child_pgnum;
+    page_t *p, *parent = NULL;
+    uint64_t version, parent_version = 0;
+    int ret, i = 0;
+
+    *leaf_pgnum = 0;
+    if ((ret = buffer_peek_page(table_id, 0, &p, &version)) != 0) return ret;
+    p_pgnum = p->root_num;
+    if (!buffer_validate(p, version)) return 1;
+    while (p_pgnum != 0) {
+        *leaf_pgnum = p_pgnum;
+        if (parent == NULL)
+            ret = buffer_peek_page(table_id, p_pgnum, &p, &version);
+        else
+            ret = buffer_peek_child(table_id, parent, parent_version, i, p_pgnum, &p, &version);
+        if (ret != 0) return ret;
+        if (p->is_leaf) break;
+        // a torn read may hold any count, keep the search within the page
+        int num_keys = p->num_keys;
+        if (num_keys > ENTRY_ORDER - 1) num_keys = ENTRY_ORDER - 1;
+        i = 0;
+        while (i < num_keys) {
+            if (key >= p->entries[i].key)
+                i++;
+            else
+                break;
+        }
+        child_pgnum = i ? p->entries[i - 1].child :
+                p->left_child;
+        if (!buffer_validate(p, version)) return 1;
+        parent = p;
+        parent_version = version;
+        p_pgnum = child_pgnum;
+    }
+    if (p_pgnum != 0 && !buffer_validate(p, version)) return 1;
+    *leaf_pgnum = p_pgnum;
+    return 0;
+}
+
+/*
+ * Tries find_leaf_optimistic() first, so that concurrent readers do not
+ * write to the latches of the upper levels. Falls back to latching the path,
+ * inner pages being stepped through with buffer_read_child(), which follows
+ * swips instead of the page table when the buffer was set up with swizzling.
+ * A descent stopped by a page that is not resident goes on latched from
+ * that page, which was reached through validated nodes.
+ */
+pagenum_t find_leaf(int64_t table_id, int64_t key) {
+    pagenum_t p_pgnum = 0;
     page_t *p, *header;
-    buffer_read_page(table_id, 0, &header);
-    p_pgnum = header->root_num;
-    buffer_unpin_page(table_id, 0);
-    if (p_pgnum == 0) return 0;
-    buffer_read_page(table_id, p_pgnum, &p);
+    for (int i = 0; i < FIND_RETRIES; i++) {
+        int ret = find_leaf_optimistic(table_id, key, &p_pgnum);
+        if (ret == 0) return p_pgnum;
+        if (ret == -1) break;
+        p_pgnum = 0;
+    }
+    if (p_pgnum == 0) {
+        buffer_read_page(table_id, 0, &header, SHARED);
+        p_pgnum = header->root_num;
+        buffer_unpin_page(table_id, 0, PRIORITY);
+        if (p_pgnum == 0) return 0;
+    }
+    buffer_read_page(table_id, p_pgnum, &p, SHARED);
     while (!p->is_leaf) {
         int i = 0;
         while (i < p->num_keys) {
@@ -117,14 +209,43 @@ pagenum_t find_leaf(int64_t table_id, int64_t key) {
             else
                 break;
         }
-        child_pgnum = i ? p->entries[i - 1].child :
+        p_pgnum = i ? p->entries[i - 1].child :
                 p->left_child;
+        buffer_read_child(table_id, &p, i, p_pgnum, SHARED, PRIORITY);
+    }
+    buffer_unpin_frame(p);
+    return p_pgnum;
+}
+
+/*
+ * Calls `visit` on every record with a key of at least `begin_key`, in key
+ * order along the leaf chain, until it returns nonzero. Leaves are read with
+ * SEQUENTIAL so a full pass does not push the working set out of the buffer.
+ * Takes no record locks. Returns the number of records visited.
+ */
+int db_scan(int64_t table_id, int64_t begin_key,
+            int (*visit)(int64_t key, char* value, uint16_t size, void* arg), void* arg) {
+    pagenum_t p_pgnum, sibling_pgnum;
+    page_t* p;
+    int count = 0;
+
+    p_pgnum = find_leaf(table_id, begin_key);
+    while (p_pgnum != 0) {
+        buffer_read_page(table_id, p_pgnum, &p, SHARED | SEQUENTIAL);
+        for (uint32_t i = 0; i < p->num_keys; i++) {
+            if (p->slots[i].key < begin_key) continue;
+            count++;
+            if (visit(p->slots[i].key, (char*)p + p->slots[i].offset,
+                      p->slots[i].size, arg) != 0) {
                 buffer_unpin_page(table_id, p_pgnum);
-                p_pgnum = child_pgnum;
-                buffer_read_page(table_id, p_pgnum, &p);
+                return count;
+            }
         }
-    buffer_unpin_page(table_id, p_pgnum);
-    return p_pgnum;
+        sibling_pgnum = p->sibling;
+        buffer_unpin_page(table_id, p_pgnum);
+        p_pgnum = sibling_pgnum;
+    }
+    return count;
 }
 
 // INSERTION
@@ -133,7 +254,8 @@ int db_insert(int64_t table_id, int64_t key, char* value, uint16_t val_size) {
     pagenum_t leaf_pgnum, root_pgnum;
     page_t *leaf, *header;
 
-    buffer_read_page(table_id, 0, &header);
+    if (file_map_page(table_id, 0) != NULL) return -1;
+    buffer_read_page(table_id, 0, &header, SHARED);
     root_pgnum = header->root_num;
     buffer_unpin_page(table_id, 0);
 
@@ -144,7 +266,7 @@ int db_insert(int64_t table_id, int64_t key, char* value, uint16_t val_size) {
 
     leaf_pgnum = find_leaf(table_id, key);
 
-    buffer_read_page(table_id, leaf_pgnum, &leaf);
+    buffer_read_page(table_id, leaf_pgnum, &leaf, SHARED);
     int i;
     int num_keys = leaf->num_keys;
     for (i = 0; i < num_keys; i++) {
@@ -233,7 +355,7 @@ void insert_into_leaf_split(int64_t table_id, pagenum_t leaf_pgnum,
         total_size += (SLOT_SIZE + temp_slots[split].size);
         if (total_size >= FREE_SPACE / 2) break;
     }
-    new_pgnum = make_leaf(table_id);
+    new_pgnum = make_leaf(table_id, leaf_pgnum);
 
     buffer_read_page(table_id, new_pgnum, &new_leaf);
 
@@ -278,7 +400,7 @@ void insert_into_parent(int64_t table_id,
     pagenum_t parent_pgnum;
     page_t *left, *parent;
 
-    buffer_read_page(table_id, left_pgnum, &left);
+    buffer_read_page(table_id, left_pgnum, &left, SHARED);
     parent_pgnum = left->parent;
     buffer_unpin_page(table_id, left_pgnum);
 
@@ -289,7 +411,7 @@ void insert_into_parent(int64_t table_id,
 
     int left_index = get_left_index(table_id, parent_pgnum, left_pgnum);
 
-    buffer_read_page(table_id, parent_pgnum, &parent);
+    buffer_read_page(table_id, parent_pgnum, &parent, SHARED);
     int num_keys = parent->num_keys;
     buffer_unpin_page(table_id, parent_pgnum);
 
@@ -340,7 +462,7 @@ void insert_into_page_split(int64_t table_id, pagenum_t old_pgnum,
     temp[left_index].key = key;
 
     int split = ENTRY_ORDER / 2 + 1;
-    new_pgnum = make_page(table_id);
+    new_pgnum = make_page(table_id, old_pgnum);
 
     buffer_read_page(table_id, new_pgnum, &new_page);
 
@@ -379,7 +501,7 @@ void start_tree(int64_t table_id, int64_t key, char* value, uint16_t val_size) {
     pagenum_t root_pgnum;
     page_t *root, *header;
 
-    root_pgnum = make_leaf(table_id);
+    root_pgnum = make_leaf(table_id, 0);
 
     buffer_read_page(table_id, root_pgnum, &root);
     buffer_read_page(table_id, 0, &header);
@@ -404,7 +526,7 @@ void insert_into_new_root(int64_t table_id,
     pagenum_t root_pgnum;
     page_t *left, *right, *root, *header;
 
-    root_pgnum = make_page(table_id);
+    root_pgnum = make_page(table_id, left_pgnum);
 
     buffer_read_page(table_id, left_pgnum, &left);
     buffer_read_page(table_id, right_pgnum, &right);
@@ -426,10 +548,10 @@ void insert_into_new_root(int64_t table_id,
     buffer_write_page(table_id, 0);
 }
 
-pagenum_t make_leaf(int64_t table_id) {
+pagenum_t make_leaf(int64_t table_id, pagenum_t near) {
     pagenum_t new_pgnum;
     page_t* new_leaf;
-    new_pgnum = make_page(table_id);
+    new_pgnum = make_page(table_id, near);
     buffer_read_page(table_id, new_pgnum, &new_leaf);
     new_leaf->is_leaf = 1;
     new_leaf->free_space = FREE_SPACE;
@@ -438,10 +560,10 @@ pagenum_t make_leaf(int64_t table_id) {
     return new_pgnum;
 }
 
-pagenum_t make_page(int64_t table_id) {
+pagenum_t make_page(int64_t table_id, pagenum_t near) {
     pagenum_t new_pgnum;
     page_t* new_page;
-    new_pgnum = buffer_alloc_page(table_id);
+    new_pgnum = buffer_alloc_page(table_id, near);
     buffer_read_page(table_id, new_pgnum, &new_page);
     new_page->parent = 0;
     new_page->is_leaf = 0;
@@ -452,7 +574,7 @@ pagenum_t make_page(int64_t table_id) {
 
 int get_left_index(int64_t table_id, pagenum_t parent_pgnum, pagenum_t left_pgnum) {
     page_t* parent;
-    buffer_read_page(table_id, parent_pgnum, &parent);
+    buffer_read_page(table_id, parent_pgnum, &parent, SHARED);
     int left_index = 0;
     if (parent->left_child == left_pgnum) {
         buffer_unpin_page(table_id, parent_pgnum);
@@ -471,9 +593,10 @@ int db_delete(int64_t table_id, int64_t key) {
     pagenum_t leaf_pgnum, sibling_pgnum, parent_pgnum;
     page_t *leaf, *sibling, *parent;
 
+    if (file_map_page(table_id, 0) != NULL) return -1;
     leaf_pgnum = find_leaf(table_id, key);
 
-    buffer_read_page(table_id, leaf_pgnum, &leaf);
+    buffer_read_page(table_id, leaf_pgnum, &leaf, SHARED);
     int i;
     int num_keys = leaf->num_keys;
     for (i = 0; i < num_keys; i++) {
@@ -485,7 +608,7 @@ int db_delete(int64_t table_id, int64_t key) {
 
     delete_from_leaf(table_id, leaf_pgnum, key);
 
-    buffer_read_page(table_id, leaf_pgnum, &leaf);
+    buffer_read_page(table_id, leaf_pgnum, &leaf, SHARED);
     parent_pgnum = leaf->parent;
     int leaf_num_keys = leaf->num_keys;
     int leaf_free_space = leaf->free_space;
@@ -503,7 +626,7 @@ int db_delete(int64_t table_id, int64_t key) {
 
     int sibling_index = get_sibling_index(table_id, parent_pgnum, leaf_pgnum);
 
-    buffer_read_page(table_id, parent_pgnum, &parent);
+    buffer_read_page(table_id, parent_pgnum, &parent, SHARED);
     int k_prime_index = (sibling_index != -1) ? sibling_index : 0;
     int64_t k_prime = parent->entries[k_prime_index].key;
     if (sibling_index == -1) {
@@ -515,7 +638,7 @@ int db_delete(int64_t table_id, int64_t key) {
     }
     buffer_unpin_page(table_id, parent_pgnum);
 
-    buffer_read_page(table_id, sibling_pgnum, &sibling);
+    buffer_read_page(table_id, sibling_pgnum, &sibling, SHARED);
     int sibling_free_space = sibling->free_space;
     buffer_unpin_page(table_id, sibling_pgnum);
 
@@ -652,7 +775,7 @@ void delete_from_child(int64_t table_id,
 
     delete_from_page(table_id, p_pgnum, key, child_pgnum);
 
-    buffer_read_page(table_id, p_pgnum, &p);
+    buffer_read_page(table_id, p_pgnum, &p, SHARED);
     parent_pgnum = p->parent;
     int p_num_keys = p->num_keys;
     buffer_unpin_page(table_id, p_pgnum);
@@ -669,7 +792,7 @@ void delete_from_child(int64_t table_id,
 
     int sibling_index = get_sibling_index(table_id, parent_pgnum, p_pgnum);
 
-    buffer_read_page(table_id, parent_pgnum, &parent);
+    buffer_read_page(table_id, parent_pgnum, &parent, SHARED);
     int k_prime_index = (sibling_index != -1) ? sibling_index : 0;
     int64_t k_prime = parent->entries[k_prime_index].key;
     if (sibling_index == 0) {
@@ -681,7 +804,7 @@ void delete_from_child(int64_t table_id,
     }
     buffer_unpin_page(table_id, parent_pgnum);
 
-    buffer_read_page(table_id, sibling_pgnum, &sibling);
+    buffer_read_page(table_id, sibling_pgnum, &sibling, SHARED);
     int sibling_num_keys = sibling->num_keys;
     buffer_unpin_page(table_id, sibling_pgnum);
 
@@ -851,7 +974,7 @@ void adjust_root(int64_t table_id, pagenum_t root_pgnum) {
 
 int get_sibling_index(int64_t table_id, pagenum_t parent_pgnum, pagenum_t p_pgnum) {
     page_t* parent;
-    buffer_read_page(table_id, parent_pgnum, &parent);
+    buffer_read_page(table_id, parent_pgnum, &parent, SHARED);
     int sibling_index = -1;
     if (parent->left_child == p_pgnum) {
         buffer_unpin_page(table_id, parent_pgnum);
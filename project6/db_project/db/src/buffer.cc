@@ -1,162 +1,1964 @@
 #include "buffer.h"
 
-#include <errno.h>
-
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#ifdef USE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
 
-static buffer_t** buffers;
+static buffer_t* buffers;
+static page_t* frames;
+static char* arena;
+static size_t arena_size;
+static int part_capacity;
 static int buffer_size;
-static pthread_mutex_t buffer_latch;
+static int buffer_policy;
+static buffer_part_t* parts;
+static int num_parts;
+static int swizzling;
 
-int init_buffer(int num_buf) {
-    buffer_size = num_buf;
-    buffers = new buffer_t*[buffer_size];
-    for (int i = 0; i < buffer_size; i++) {
-        buffers[i] = NULL;
+// NUMA topology, a single node unless built with USE_NUMA
+static int num_nodes;
+static std::vector<int> cpu_nodes;
+static std::vector<int> node_first_part;    // partitions of a node are contiguous
+static std::vector<int> node_num_parts;
+
+struct buffer_affinity_t {
+    int64_t table_id;
+    int node;
+};
+
+static buffer_affinity_t affinities[BUFFER_MAX_AFFINITIES];
+static std::atomic<int> num_affinities;
+static std::atomic<int>* swips;    // BUFFER_SWIP_SLOTS per frame, frame index + 1
+static std::atomic<int>* peek_hints;
+
+/*
+ * Hits taken without the partition latch, by optimistic reads or through
+ * swips, which write nothing shared for them: each thread counts them in
+ * counters of its own, summed by buffer_get_stats(). The counters of a thread
+ * that exits are kept and handed to the next new thread.
+ */
+struct alignas(64) buffer_thread_counts_t {
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> table_hits[FILE_MAX_TABLES];
+    std::atomic<uint64_t> swip_hits;
+};
+
+struct buffer_thread_owner_t {
+    buffer_thread_counts_t* counts = NULL;
+    ~buffer_thread_owner_t();
+};
+
+static pthread_mutex_t thread_counts_latch = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<buffer_thread_counts_t*> thread_counts;
+static std::vector<buffer_thread_counts_t*> free_thread_counts;
+static thread_local buffer_thread_owner_t thread_owner;
+
+static std::vector<pthread_t> cleaner_threads;   // one per node
+static pthread_mutex_t cleaner_latch;
+static pthread_cond_t cleaner_cond;
+static int cleaner_running;
+static FILE* stats_fp;
+static int stats_interval_ms;
+
+static pthread_mutex_t resize_latch;
+static int priority_budget;
+
+static std::string resident_path;
+static int resident_interval_ms;
+
+static int checkpoint_interval_ms;
+static uint64_t checkpoint_LSN;     // log end when the last checkpoint began
+
+struct buffer_warmup_t {
+    int64_t table_id;
+    std::vector<pagenum_t> page_nums;
+};
+
+static pthread_mutex_t warmup_latch;
+static std::unordered_map<int64_t, std::vector<pagenum_t>> warmup_pages;
+static std::vector<pthread_t> warmup_threads;
+static std::atomic<int> warmup_running;
+
+static pthread_t prefetch_threads[BUFFER_PREFETCH_THREADS];
+static pthread_mutex_t prefetch_latch;
+static pthread_cond_t prefetch_cond;
+static std::deque<int> prefetch_queue;
+static int prefetch_running;
+
+// Counts an event of the table in slot `slot`, -1 for a table not open.
+static void buffer_count(buffer_part_t* part, int slot, uint64_t buffer_stats_t::*counter) {
+    part->stats.*counter += 1;
+    if (slot != -1)
+        part->table_stats[slot].*counter += 1;
+}
+
+// Node of the CPU the calling thread runs on.
+static int buffer_current_node() {
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= (int)cpu_nodes.size()) return 0;
+    return cpu_nodes[cpu];
+}
+
+// Counts a request as local or remote, which only tells apart several nodes.
+static void buffer_count_access(buffer_part_t* part, int slot) {
+    if (num_nodes == 1)
+        return;
+    buffer_count(part, slot, buffer_current_node() == part->node ?
+                 &buffer_stats_t::local : &buffer_stats_t::remote);
+}
+
+buffer_thread_owner_t::~buffer_thread_owner_t() {
+    if (counts == NULL) return;
+    pthread_mutex_lock(&thread_counts_latch);
+    free_thread_counts.push_back(counts);
+    pthread_mutex_unlock(&thread_counts_latch);
+}
+
+static void buffer_clear_thread_counts(buffer_thread_counts_t* counts) {
+    counts->hits = 0;
+    for (int i = 0; i < FILE_MAX_TABLES; i++) {
+        counts->table_hits[i] = 0;
+    }
+    counts->swip_hits = 0;
+}
+
+// Counters of the calling thread, taken on its first hit without a latch.
+static buffer_thread_counts_t* buffer_get_thread_counts() {
+    if (thread_owner.counts != NULL)
+        return thread_owner.counts;
+    pthread_mutex_lock(&thread_counts_latch);
+    if (!free_thread_counts.empty()) {
+        thread_owner.counts = free_thread_counts.back();
+        free_thread_counts.pop_back();
+    } else {
+        thread_owner.counts = new buffer_thread_counts_t;
+        buffer_clear_thread_counts(thread_owner.counts);
+        thread_counts.push_back(thread_owner.counts);
+    }
+    pthread_mutex_unlock(&thread_counts_latch);
+    return thread_owner.counts;
+}
+
+// Adds one to a counter only the calling thread writes.
+static void buffer_count_own(std::atomic<uint64_t>* counter) {
+    counter->store(counter->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// Counts a hit of buffer_peek_page() for the calling thread.
+static void buffer_count_peek(int64_t table_id) {
+    buffer_thread_counts_t* counts = buffer_get_thread_counts();
+    buffer_count_own(&(counts->hits));
+    int slot = file_get_slot(table_id);
+    if (slot != -1)
+        buffer_count_own(&(counts->table_hits[slot]));
+}
+
+// Counts a child reached through a swip by the calling thread.
+static void buffer_count_swip() {
+    buffer_count_own(&(buffer_get_thread_counts()->swip_hits));
+}
+
+static void buffer_detect_nodes() {
+    num_nodes = 1;
+    cpu_nodes.clear();
+#ifdef USE_NUMA
+    if (numa_available() < 0) return;
+    num_nodes = numa_max_node() + 1;
+    int num_cpus = numa_num_configured_cpus();
+    for (int cpu = 0; cpu < num_cpus; cpu++) {
+        int node = numa_node_of_cpu(cpu);
+        cpu_nodes.push_back(node < 0 ? 0 : node);
+    }
+#endif
+}
+
+/*
+ * Prefers `node` for the pages of [addr, addr + len) not touched yet, shrunk
+ * to whole pages. Left to first touch where the policy cannot be set.
+ */
+static void buffer_bind_memory(void* addr, size_t len, int node) {
+#ifdef USE_NUMA
+    uintptr_t begin = ((uintptr_t)addr + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(uintptr_t)(PAGE_SIZE - 1);
+    if (num_nodes < 2 || end <= begin) return;
+    unsigned long mask[16] = {0};
+    const int bits = 8 * sizeof(unsigned long);
+    if (node >= 16 * bits) return;
+    mask[node / bits] = 1UL << (node % bits);
+    mbind((void*)begin, end - begin, MPOL_PREFERRED, mask, 16 * bits, 0);
+#else
+    (void)addr, (void)len, (void)node;
+#endif
+}
+
+static int buffer_wait_bucket(struct timespec* begin, struct timespec* end) {
+    uint64_t wait_us = ((end->tv_sec - begin->tv_sec) * 1000000000L +
+                        (end->tv_nsec - begin->tv_nsec)) / 1000;
+    int bucket = 0;
+    while (wait_us > 1 && bucket < BUFFER_WAIT_BUCKETS - 1) {
+        wait_us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Takes the partition latch, timing the wait only when it is contended.
+static void buffer_lock_part(buffer_part_t* part) {
+    if (pthread_mutex_trylock(&(part->part_latch)) == 0) return;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    pthread_mutex_lock(&(part->part_latch));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    part->stats.part_waits[buffer_wait_bucket(&begin, &end)]++;
+}
+
+/*
+ * Marks a frame as changing for optimistic readers, called with its latch
+ * held EXCLUSIVE or, for a frame with no latch holder, its partition latch.
+ * buffer_end_change() must follow before the frame is used again.
+ */
+static void buffer_begin_change(buffer_t* buffer) {
+    buffer->version++;
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void buffer_end_change(buffer_t* buffer) {
+    buffer->version++;
+}
+
+// Releases a page latch, ending the change of an EXCLUSIVE holder.
+static void buffer_unlatch_page(buffer_t* buffer) {
+    if (buffer->version & 1)
+        buffer_end_change(buffer);
+    pthread_rwlock_unlock(&(buffer->page_latch));
+}
+
+// Takes a written back frame off the flush list, with the partition latch held.
+static void buffer_mark_clean(buffer_part_t* part, int buffer_idx) {
+    buffer_t* buffer = &buffers[buffer_idx];
+    part->flush_list.erase({buffer->rec_LSN, buffer_idx});
+    buffer->is_dirty = 0;
+}
+
+/*
+ * Writes back the given frames of `part`, pinned by the caller, as one
+ * batch, and drops their pins. A frame whose latch is held EXCLUSIVE is
+ * being changed and left for later: waiting for it while holding the other
+ * latches could deadlock with a modification latching several pages. The
+ * log is forced first when a page carries changes not yet in it.
+ */
+static void buffer_clean_frames(buffer_part_t* part, const int* dirty, int num_dirty) {
+    std::vector<int> latched;
+    std::vector<file_io_t> ios;
+    uint64_t max_LSN = 0;
+    for (int i = 0; i < num_dirty; i++) {
+        buffer_t* buffer = &buffers[dirty[i]];
+        if (pthread_rwlock_tryrdlock(&(buffer->page_latch)) != 0) {
+            buffer->pin_count--;
+            continue;
+        }
+        if (buffer->is_dirty == 0) {
+            pthread_rwlock_unlock(&(buffer->page_latch));
+            buffer->pin_count--;
+            continue;
+        }
+        latched.push_back(dirty[i]);
+        ios.push_back({buffer->table_id, buffer->page_num, buffer->frame, 1});
+        if (buffer->frame->page_LSN > max_LSN)
+            max_LSN = buffer->frame->page_LSN;
+    }
+    if (latched.empty()) return;
+
+    if (max_LSN >= log_get_durable_LSN())
+        log_force();
+    file_submit_io(ios.data(), ios.size());
+    buffer_lock_part(part);
+    for (int buffer_idx : latched) {
+        buffer_mark_clean(part, buffer_idx);
+        buffer_count(part, file_get_slot(buffers[buffer_idx].table_id),
+                     &buffer_stats_t::bg_flushes);
+    }
+    pthread_mutex_unlock(&(part->part_latch));
+    for (int buffer_idx : latched) {
+        pthread_rwlock_unlock(&(buffers[buffer_idx].page_latch));
+        buffers[buffer_idx].pin_count--;
+    }
+}
+
+/*
+ * Frames the cleaner may pin in a partition at once, leaving the rest to
+ * foreground requests looking for a victim.
+ */
+static int buffer_cleaner_quota(buffer_part_t* part) {
+    int quota = part->size / BUFFER_CLEANER_SHARE;
+    if (quota > 2 * BUFFER_CLEANER_DEPTH) quota = 2 * BUFFER_CLEANER_DEPTH;
+    return quota < 1 ? 1 : quota;
+}
+
+/*
+ * Writes back dirty, unpinned frames among the next ones the replacer of
+ * `part` would evict, so that foreground requests find clean victims, and
+ * the oldest ones of the flush list, so that pages holding recovery back
+ * reach disk first. Kept frames, never evicted, are cleaned that way.
+ */
+static void buffer_clean_part(buffer_part_t* part) {
+    int candidates[2 * BUFFER_CLEANER_DEPTH];
+    int dirty[2 * BUFFER_CLEANER_DEPTH];
+    int num_dirty = 0;
+
+    buffer_lock_part(part);
+    int quota = buffer_cleaner_quota(part);
+    int num_candidates = part->replacer->candidates(candidates, BUFFER_CLEANER_DEPTH);
+    for (auto it = part->flush_list.begin();
+         it != part->flush_list.end() && num_candidates < 2 * BUFFER_CLEANER_DEPTH; ++it) {
+        candidates[num_candidates++] = it->second - part->base;
+    }
+    for (int i = 0; i < num_candidates && num_dirty < quota; i++) {
+        buffer_t* buffer = &buffers[part->base + candidates[i]];
+        if (buffer->is_dirty == 0 || buffer->pin_count != 0) continue;
+        buffer->pin_count++;
+        dirty[num_dirty++] = part->base + candidates[i];
+    }
+    pthread_mutex_unlock(&(part->part_latch));
+
+    buffer_clean_frames(part, dirty, num_dirty);
+}
+
+// Writes back every dirty frame in use, with no other thread in the buffer.
+static void buffer_write_back() {
+    std::vector<file_io_t> ios;
+    log_force();
+    for (int i = 0; i < num_parts; i++) {
+        for (int j = parts[i].base; j < parts[i].base + parts[i].used; j++) {
+            if (buffers[j].is_dirty == 0) continue;
+            ios.push_back({buffers[j].table_id, buffers[j].page_num, buffers[j].frame, 1});
+            buffers[j].is_dirty = 0;
+        }
+        parts[i].flush_list.clear();
+    }
+    if (!ios.empty())
+        file_submit_io(ios.data(), ios.size());
+}
+
+/*
+ * Cleaner thread of a node, run on that node and cleaning its partitions.
+ * The one of node 0 also takes checkpoints, writes the statistics dump and
+ * saves the resident pages when set up with buffer_set_checkpoint(),
+ * buffer_set_stats_dump() and buffer_set_resident_dump().
+ */
+static void* buffer_cleaner(void* arg) {
+    int node = (int)(intptr_t)arg;
+    struct timespec last_dump, last_save, last_checkpoint, now;
+#ifdef USE_NUMA
+    if (num_nodes > 1)
+        numa_run_on_node(node);
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &last_dump);
+    last_save = last_dump;
+    last_checkpoint = last_dump;
+    pthread_mutex_lock(&cleaner_latch);
+    while (cleaner_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += BUFFER_CLEANER_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&cleaner_cond, &cleaner_latch, &deadline);
+        if (!cleaner_running) break;
+        pthread_mutex_unlock(&cleaner_latch);
+
+        for (int i = 0; i < num_parts; i++) {
+            if (parts[i].node == node) buffer_clean_part(&parts[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (node == 0 && checkpoint_interval_ms > 0 &&
+            (now.tv_sec - last_checkpoint.tv_sec) * 1000L +
+            (now.tv_nsec - last_checkpoint.tv_nsec) / 1000000L >= checkpoint_interval_ms) {
+            buffer_checkpoint();
+            last_checkpoint = now;
+        }
+        pthread_mutex_lock(&cleaner_latch);
+        if (node != 0) continue;
+
+        if (stats_fp != NULL && (now.tv_sec - last_dump.tv_sec) * 1000L +
+            (now.tv_nsec - last_dump.tv_nsec) / 1000000L >= stats_interval_ms) {
+            buffer_dump_stats(stats_fp);
+            last_dump = now;
+        }
+        if (resident_interval_ms > 0 && (now.tv_sec - last_save.tv_sec) * 1000L +
+            (now.tv_nsec - last_save.tv_nsec) / 1000000L >= resident_interval_ms) {
+            buffer_save_resident(resident_path.c_str());
+            last_save = now;
+        }
+    }
+    pthread_mutex_unlock(&cleaner_latch);
+    return NULL;
+}
+
+/*
+ * Prefetch worker: reads the pages of frames reserved by
+ * buffer_prefetch_pages(), up to FILE_IO_BATCH queued frames in one batch,
+ * then clears their pending flag and pin.
+ * Exits once stopped and the queue is drained.
+ */
+static void* buffer_prefetcher(void*) {
+    int batch[FILE_IO_BATCH];
+    file_io_t ios[FILE_IO_BATCH];
+    while (true) {
+        pthread_mutex_lock(&prefetch_latch);
+        while (prefetch_running && prefetch_queue.empty())
+            pthread_cond_wait(&prefetch_cond, &prefetch_latch);
+        if (prefetch_queue.empty()) {
+            pthread_mutex_unlock(&prefetch_latch);
+            return NULL;
+        }
+        int n = 0;
+        while (n < FILE_IO_BATCH && !prefetch_queue.empty()) {
+            batch[n++] = prefetch_queue.front();
+            prefetch_queue.pop_front();
+        }
+        pthread_mutex_unlock(&prefetch_latch);
+
+        for (int i = 0; i < n; i++) {
+            buffer_t* buffer = &buffers[batch[i]];
+            ios[i] = {buffer->table_id, buffer->page_num, buffer->frame, 0};
+        }
+        file_submit_io(ios, n);
+        for (int i = 0; i < n; i++) {
+            buffer_t* buffer = &buffers[batch[i]];
+            buffer_part_t* part = buffer_get_part(buffer->table_id, buffer->page_num);
+            buffer_lock_part(part);
+            buffer_end_change(buffer);
+            buffer->io_pending = 0;
+            part->pending--;
+            pthread_cond_broadcast(&(part->io_cond));
+            pthread_mutex_unlock(&(part->part_latch));
+            buffer->pin_count--;
+        }
+    }
+}
+
+static int buffer_start_prefetcher() {
+    prefetch_running = 1;
+    for (int i = 0; i < BUFFER_PREFETCH_THREADS; i++) {
+        if (pthread_create(&prefetch_threads[i], 0, buffer_prefetcher, NULL) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void buffer_stop_prefetcher() {
+    pthread_mutex_lock(&prefetch_latch);
+    prefetch_running = 0;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_latch);
+    for (int i = 0; i < BUFFER_PREFETCH_THREADS; i++) {
+        pthread_join(prefetch_threads[i], NULL);
+    }
+}
+
+// Waits until the frames holding the given pages have no prefetch read pending.
+static void buffer_wait_pages(int64_t table_id, pagenum_t* page_nums, int n) {
+    for (int i = 0; i < n; i++) {
+        buffer_part_t* part = buffer_get_part(table_id, page_nums[i]);
+        buffer_lock_part(part);
+        auto it = part->page_table.find({table_id, page_nums[i]});
+        if (it != part->page_table.end()) {
+            while (buffers[it->second].io_pending)
+                pthread_cond_wait(&(part->io_cond), &(part->part_latch));
+        }
+        pthread_mutex_unlock(&(part->part_latch));
+    }
+}
+
+/*
+ * Warm-up thread for one table: prefetches the pages it had resident, in
+ * page order, a batch at a time, waiting for the reads of each batch to
+ * complete before the next.
+ */
+static void* buffer_warmer(void* arg) {
+    buffer_warmup_t* warmup = (buffer_warmup_t*)arg;
+    std::vector<pagenum_t>& page_nums = warmup->page_nums;
+    page_t* header;
+
+    // pages freed since the list was saved may lie beyond the file
+    buffer_read_page(warmup->table_id, 0, &header, SHARED);
+    pagenum_t num_pages = header->num_pages;
+    buffer_unpin_page(warmup->table_id, 0);
+    std::sort(page_nums.begin(), page_nums.end());
+    page_nums.erase(std::unique(page_nums.begin(), page_nums.end()), page_nums.end());
+    page_nums.erase(std::lower_bound(page_nums.begin(), page_nums.end(), num_pages),
+                    page_nums.end());
+
+    int batch = buffer_size / (2 * BUFFER_PREFETCH_SHARE);
+    if (batch > BUFFER_WARMUP_BATCH) batch = BUFFER_WARMUP_BATCH;
+    if (batch < 1) batch = 1;
+    for (size_t i = 0; i < page_nums.size() && warmup_running; i += batch) {
+        int n = std::min((size_t)batch, page_nums.size() - i);
+        buffer_prefetch_pages(warmup->table_id, &page_nums[i], n);
+        buffer_wait_pages(warmup->table_id, &page_nums[i], n);
+    }
+    delete warmup;
+    return NULL;
+}
+
+static void buffer_stop_warmers() {
+    pthread_mutex_lock(&warmup_latch);
+    warmup_running = 0;
+    std::vector<pthread_t> threads;
+    threads.swap(warmup_threads);
+    warmup_pages.clear();
+    pthread_mutex_unlock(&warmup_latch);
+    for (pthread_t thread : threads) {
+        pthread_join(thread, NULL);
+    }
+}
+
+static int buffer_start_cleaner() {
+    cleaner_running = 1;
+    cleaner_threads.resize(num_nodes);
+    for (int i = 0; i < num_nodes; i++) {
+        if (pthread_create(&cleaner_threads[i], 0, buffer_cleaner, (void*)(intptr_t)i) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void buffer_stop_cleaner() {
+    pthread_mutex_lock(&cleaner_latch);
+    cleaner_running = 0;
+    pthread_cond_broadcast(&cleaner_cond);
+    pthread_mutex_unlock(&cleaner_latch);
+    for (pthread_t thread : cleaner_threads) {
+        pthread_join(thread, NULL);
+    }
+}
+
+static void buffer_size_ring(buffer_part_t* part) {
+    part->ring_size = BUFFER_RING_SIZE / num_parts;
+    if (part->ring_size > part->size / 8)
+        part->ring_size = part->size / 8;
+    if (part->ring_size < 1)
+        part->ring_size = 1;
+}
+
+/*
+ * Swizzling. A swip is the frame index of a resident child, kept for a slot
+ * of an inner page (0 for left_child, i for entries[i - 1]) so traversals go
+ * from parent to child without the page table. Swips of a frame are only set
+ * under its page latch held SHARED, and cleared under it held EXCLUSIVE,
+ * which every modification of the page takes. Each frame is referred to by at
+ * most one swip, and while it is a frame can only be evicted after clearing
+ * that swip under the latch of its parent.
+ */
+
+// Clears the swips of a frame, called with its page latch held EXCLUSIVE.
+static void buffer_clear_swips(int buffer_idx) {
+    std::atomic<int>* slots = &swips[(size_t)buffer_idx * BUFFER_SWIP_SLOTS];
+    for (int i = 0; i < BUFFER_SWIP_SLOTS && buffers[buffer_idx].swip_count != 0; i++) {
+        int child_idx = slots[i] - 1;
+        if (child_idx == -1) continue;
+        slots[i] = 0;
+        buffers[child_idx].swip_parent = -1;
+        buffers[buffer_idx].swip_count--;
     }
-    if (pthread_mutex_init(&buffer_latch, 0) != 0)
+}
+
+/*
+ * Clears the swip referring to a frame, which fails if the latch of its
+ * parent is held.
+ */
+static int buffer_unswizzle_parent(int buffer_idx) {
+    buffer_t* buffer = &buffers[buffer_idx];
+    int parent_idx = buffer->swip_parent;
+    if (parent_idx == -1)
+        return 0;
+    buffer_t* parent = &buffers[parent_idx];
+    if (pthread_rwlock_trywrlock(&(parent->page_latch)) != 0)
         return -1;
+    // the parent may have cleared its swips before the latch was taken
+    if (buffer->swip_parent == parent_idx) {
+        swips[(size_t)parent_idx * BUFFER_SWIP_SLOTS + buffer->swip_slot] = 0;
+        parent->swip_count--;
+        buffer->swip_parent = -1;
+    }
+    pthread_rwlock_unlock(&(parent->page_latch));
+    return buffer->swip_parent != -1 ? -1 : 0;
+}
+
+/*
+ * Clears the swip referring to a frame and the swips it holds, before it is
+ * evicted. Fails if a latch involved is held, leaving the frame swizzled.
+ */
+static int buffer_unswizzle(int buffer_idx) {
+    buffer_t* buffer = &buffers[buffer_idx];
+    if (buffer_unswizzle_parent(buffer_idx) != 0)
+        return -1;
+    if (buffer->swip_count != 0) {
+        if (pthread_rwlock_trywrlock(&(buffer->page_latch)) != 0)
+            return -1;
+        buffer_clear_swips(buffer_idx);
+        pthread_rwlock_unlock(&(buffer->page_latch));
+    }
     return 0;
 }
 
-int shutdown_buffer() {
-    for (int i = 0; i < buffer_size; i++) {
-        if (buffers[i] != NULL && buffers[i]->is_dirty != 0)
-            file_write_page(buffers[i]->table_id, buffers[i]->page_num, &(buffers[i]->frame));
-        delete buffers[i];
+// Marks a kept frame used, writing to it only if it was not marked yet.
+static void buffer_ref_priority(buffer_t* buffer) {
+    if (buffer->priority && !buffer->priority_ref.load(std::memory_order_relaxed))
+        buffer->priority_ref.store(1, std::memory_order_relaxed);
+}
+
+/*
+ * Hands a frame no longer kept back to the replacer. Only kept frames are
+ * swizzled, so the swip referring to it is cleared too, unless the latch of
+ * its parent is held, in which case eviction clears it.
+ */
+static void buffer_demote(buffer_part_t* part, int buffer_idx) {
+    buffers[buffer_idx].priority = 0;
+    part->replacer->insert(buffer_idx - part->base,
+                           buffers[buffer_idx].table_id, buffers[buffer_idx].page_num);
+    if (swizzling)
+        buffer_unswizzle_parent(buffer_idx);
+}
+
+// Hands a kept frame back to the replacer.
+static void buffer_leave_priority(buffer_part_t* part, int buffer_idx) {
+    for (int pos = 0; pos < (int)part->priority.size(); pos++) {
+        if (part->priority[pos] != buffer_idx) continue;
+        part->priority[pos] = part->priority.back();
+        part->priority.pop_back();
+        break;
     }
-    delete[] buffers;
-    if (pthread_mutex_destroy(&buffer_latch) != 0)
+    buffer_demote(part, buffer_idx);
+}
+
+// Sets the number of frames a partition may keep, releasing any excess.
+static void buffer_size_priority(buffer_part_t* part) {
+    if (priority_budget < 0)
+        part->priority_size = part->size / BUFFER_PRIORITY_SHARE;
+    else
+        part->priority_size = priority_budget / num_parts +
+                              (part - parts < priority_budget % num_parts);
+    if (part->priority_size > part->size / 2)
+        part->priority_size = part->size / 2;
+    while ((int)part->priority.size() > part->priority_size) {
+        buffer_leave_priority(part, part->priority.back());
+    }
+}
+
+// Extends a partition to `new_size` frames, called with its latch held.
+static int buffer_grow_part(buffer_part_t* part, int new_size) {
+    for (int i = part->base + part->size; i < part->base + new_size; i++) {
+        // versions are never reset, a stale optimistic read must not validate
+        buffers[i].frame = &frames[i];
+        buffers[i].table_id = -1;
+        buffers[i].is_dirty = 0;
+        buffers[i].in_ring = 0;
+        buffers[i].priority = 0;
+        buffers[i].io_pending = 0;
+        buffers[i].pin_count = 0;
+        buffers[i].swip_parent = -1;
+        buffers[i].swip_count = 0;
+        buffers[i].swip_ref = 0;
+        buffers[i].priority_ref = 0;
+        if (pthread_rwlock_init(&(buffers[i].page_latch), 0) != 0)
+            return -1;
+    }
+    part->replacer->resize(new_size);
+    part->size = new_size;
+    buffer_size_ring(part);
+    buffer_size_priority(part);
+    return 0;
+}
+
+int init_buffer(int num_buf, int policy, int num_part, int swizzle) {
+    buffer_size = num_buf;
+    buffer_policy = policy;
+    num_parts = num_part;
+    swizzling = swizzle;
+    if (num_parts > buffer_size / BUFFER_PART_MIN_FRAMES)
+        num_parts = buffer_size / BUFFER_PART_MIN_FRAMES;
+    if (num_parts < 1)
+        num_parts = 1;
+    buffer_detect_nodes();
+
+    /*
+     * Frames live in one aligned arena and their metadata apart in `buffers`.
+     * Address space is reserved for every partition up to `part_capacity`
+     * frames, partition i starting at frame i * part_capacity, so that a
+     * partition can grow in place and pinned frames never move. Memory is
+     * only committed as frames are first used.
+     */
+    part_capacity = BUFFER_MAX_FRAMES / num_parts;
+    if (part_capacity < buffer_size / num_parts + 1)
+        part_capacity = buffer_size / num_parts + 1;
+    size_t reserved = (size_t)part_capacity * num_parts;
+    arena_size = reserved * PAGE_SIZE + BUFFER_ARENA_ALIGN;
+    arena = (char*)mmap(NULL, arena_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED)
+        return -1;
+    frames = (page_t*)(((uintptr_t)arena + BUFFER_ARENA_ALIGN - 1) & ~(uintptr_t)(BUFFER_ARENA_ALIGN - 1));
+#ifdef MADV_HUGEPAGE
+    madvise(frames, reserved * PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+    buffers = (buffer_t*)mmap(NULL, reserved * sizeof(buffer_t), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buffers == MAP_FAILED)
+        return -1;
+    // swips are kept beside the frames, so page images never hold pointers
+    if (swizzling) {
+        swips = (std::atomic<int>*)mmap(NULL, reserved * BUFFER_SWIP_SLOTS * sizeof(int),
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (swips == MAP_FAILED)
+            return -1;
+    }
+
+    /*
+     * Partitions are spread over the nodes in contiguous groups, and the
+     * frames and metadata of each are preferably placed on its node before
+     * they are first touched.
+     */
+    node_first_part.assign(num_nodes, 0);
+    node_num_parts.assign(num_nodes, 0);
+    for (int i = num_parts - 1; i >= 0; i--) {
+        int node = (int)((int64_t)i * num_nodes / num_parts);
+        node_first_part[node] = i;
+        node_num_parts[node]++;
+    }
+    for (int i = 0; i < num_parts; i++) {
+        int node = (int)((int64_t)i * num_nodes / num_parts);
+        buffer_bind_memory(&frames[(size_t)i * part_capacity],
+                           (size_t)part_capacity * PAGE_SIZE, node);
+        buffer_bind_memory(&buffers[(size_t)i * part_capacity],
+                           (size_t)part_capacity * sizeof(buffer_t), node);
+        if (swizzling)
+            buffer_bind_memory(&swips[(size_t)i * part_capacity * BUFFER_SWIP_SLOTS],
+                               (size_t)part_capacity * BUFFER_SWIP_SLOTS * sizeof(int), node);
+    }
+    num_affinities = 0;
+
+    peek_hints = new std::atomic<int>[BUFFER_PEEK_HINTS];
+    for (int i = 0; i < BUFFER_PEEK_HINTS; i++) {
+        peek_hints[i] = -1;
+    }
+
+    priority_budget = -1;
+    // threads keep their counters from a previous buffer
+    pthread_mutex_lock(&thread_counts_latch);
+    for (buffer_thread_counts_t* counts : thread_counts) {
+        buffer_clear_thread_counts(counts);
+    }
+    pthread_mutex_unlock(&thread_counts_latch);
+    parts = new buffer_part_t[num_parts];
+    for (int i = 0; i < num_parts; i++) {
+        parts[i].base = i * part_capacity;
+        parts[i].node = (int)((int64_t)i * num_nodes / num_parts);
+        parts[i].size = 0;
+        parts[i].used = 0;
+        parts[i].pending = 0;
+        parts[i].ring_next = 0;
+        parts[i].priority_hand = 0;
+        memset(&(parts[i].stats), 0, sizeof(buffer_stats_t));
+        memset(parts[i].table_stats, 0, sizeof(parts[i].table_stats));
+        for (int j = 0; j < BUFFER_WAIT_BUCKETS; j++) {
+            parts[i].page_waits[j] = 0;
+        }
+        parts[i].replacer = replacer_create(buffer_policy, 0);
+        if (parts[i].replacer == NULL)
+            return -1;
+        if (pthread_mutex_init(&(parts[i].part_latch), 0) != 0)
+            return -1;
+        if (pthread_cond_init(&(parts[i].io_cond), 0) != 0)
+            return -1;
+        if (buffer_grow_part(&parts[i], buffer_size / num_parts + (i < buffer_size % num_parts)) != 0)
+            return -1;
+        parts[i].page_table.reserve(parts[i].size);
+    }
+
+    if (pthread_mutex_init(&resize_latch, 0) != 0)
+        return -1;
+    stats_fp = NULL;
+    resident_interval_ms = 0;
+    checkpoint_interval_ms = 0;
+    checkpoint_LSN = 0;
+    warmup_running = 1;
+    if (pthread_mutex_init(&warmup_latch, 0) != 0)
+        return -1;
+    if (pthread_mutex_init(&cleaner_latch, 0) != 0)
+        return -1;
+    if (pthread_cond_init(&cleaner_cond, 0) != 0)
         return -1;
+    if (pthread_mutex_init(&prefetch_latch, 0) != 0)
+        return -1;
+    if (pthread_cond_init(&prefetch_cond, 0) != 0)
+        return -1;
+    if (buffer_start_prefetcher() != 0)
+        return -1;
+    return buffer_start_cleaner();
+}
+
+int shutdown_buffer() {
+    buffer_stop_warmers();
+    pthread_mutex_destroy(&warmup_latch);
+    buffer_stop_prefetcher();
+    pthread_mutex_destroy(&prefetch_latch);
+    pthread_cond_destroy(&prefetch_cond);
+    buffer_stop_cleaner();
+    pthread_mutex_destroy(&cleaner_latch);
+    pthread_cond_destroy(&cleaner_cond);
+
+    buffer_write_back();
+    buffer_checkpoint();
+    pthread_mutex_destroy(&resize_latch);
+    for (int i = 0; i < num_parts; i++) {
+        for (int j = parts[i].base; j < parts[i].base + parts[i].size; j++) {
+            pthread_rwlock_destroy(&(buffers[j].page_latch));
+        }
+        delete parts[i].replacer;
+        pthread_cond_destroy(&(parts[i].io_cond));
+        if (pthread_mutex_destroy(&(parts[i].part_latch)) != 0)
+            return -1;
+    }
+    delete[] parts;
+    delete[] peek_hints;
+    munmap(buffers, (size_t)part_capacity * num_parts * sizeof(buffer_t));
+    if (swizzling)
+        munmap(swips, (size_t)part_capacity * num_parts * BUFFER_SWIP_SLOTS * sizeof(int));
+    munmap(arena, arena_size);
     return 0;
 }
 
-int buffer_get_first_LRU_idx() {
-    for (int i = 0; i < buffer_size; i++)
-        if (buffers[i] != NULL && buffers[i]->prev_LRU == NULL) return i;
-    return -1;
+// Tables bound with buffer_set_table_node() only use the partitions of a node.
+buffer_part_t* buffer_get_part(int64_t table_id, pagenum_t page_num) {
+    size_t hash = pair_hash()({table_id, page_num});
+    int n = num_affinities.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        if (affinities[i].table_id != table_id) continue;
+        int node = affinities[i].node;
+        return &parts[node_first_part[node] + hash % node_num_parts[node]];
+    }
+    return &parts[hash % num_parts];
 }
 
-int buffer_get_last_LRU_idx() {
-    for (int i = 0; i < buffer_size; i++)
-        if (buffers[i] != NULL && buffers[i]->next_LRU == NULL) return i;
-    return -1;
+/*
+ * Frames beyond the size of a partition being shrunk are left to the resize.
+ * Following a swip does not reach the replacer, so a frame reached that way
+ * since it was last considered gets a second chance, and is otherwise
+ * unswizzled before it is evicted. Pins taken through a swip are only
+ * excluded once the swip is cleared, hence the second look at the pin count.
+ */
+int buffer_try_evict(void* arg, int idx) {
+    buffer_part_t* part = (buffer_part_t*)arg;
+    buffer_t* buffer = &buffers[part->base + idx];
+    if (buffer->pin_count != 0 || idx >= part->size) return 0;
+    if (!swizzling) return 1;
+    if (buffer->swip_ref) {
+        buffer->swip_ref = 0;
+        return 0;
+    }
+    return buffer_unswizzle(part->base + idx) == 0 && buffer->pin_count == 0;
+}
+
+static int buffer_try_evict_clean(void* arg, int idx) {
+    buffer_part_t* part = (buffer_part_t*)arg;
+    return buffer_try_evict(arg, idx) && buffers[part->base + idx].is_dirty == 0;
+}
+
+// Takes the page latch of a pinned frame, timing the wait when contended.
+void buffer_latch_page(buffer_t* buffer, int mode) {
+    if (mode == SHARED) {
+        if (pthread_rwlock_tryrdlock(&(buffer->page_latch)) == 0) return;
+    } else {
+        if (pthread_rwlock_trywrlock(&(buffer->page_latch)) == 0) {
+            buffer_begin_change(buffer);
+            return;
+        }
+    }
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if (mode == SHARED)
+        pthread_rwlock_rdlock(&(buffer->page_latch));
+    else
+        pthread_rwlock_wrlock(&(buffer->page_latch));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (mode != SHARED)
+        buffer_begin_change(buffer);
+    buffer_part_t* part = buffer_get_part(buffer->table_id, buffer->page_num);
+    part->page_waits[buffer_wait_bucket(&begin, &end)]++;
 }
 
 int buffer_get_buffer_idx(int64_t table_id, pagenum_t page_num) {
-    for (int i = 0; i < buffer_size; i++) {
-        if (buffers[i] == NULL ||
-            (buffers[i]->table_id == table_id && buffers[i]->page_num == page_num))
-            return i;
+    buffer_part_t* part = buffer_get_part(table_id, page_num);
+    buffer_lock_part(part);
+    auto it = part->page_table.find({table_id, page_num});
+    int buffer_idx = (it != part->page_table.end()) ? it->second : -1;
+    pthread_mutex_unlock(&(part->part_latch));
+    return buffer_idx;
+}
+
+/*
+ * Writes back a dirty victim found while the partition latch is held.
+ * Releases the partition latch; the caller looks for a victim again.
+ */
+static void buffer_write_victim(buffer_part_t* part, buffer_t* buffer) {
+    buffer->pin_count++;
+    pthread_mutex_unlock(&(part->part_latch));
+    pthread_rwlock_rdlock(&(buffer->page_latch));
+    if (buffer->is_dirty != 0) {
+        if (buffer->frame->page_LSN >= log_get_durable_LSN())
+            log_force();
+        file_write_page(buffer->table_id, buffer->page_num, buffer->frame);
+        buffer_lock_part(part);
+        buffer_mark_clean(part, buffer - buffers);
+        buffer_count(part, file_get_slot(buffer->table_id), &buffer_stats_t::fg_flushes);
+        pthread_mutex_unlock(&(part->part_latch));
+    }
+    pthread_rwlock_unlock(&(buffer->page_latch));
+    buffer->pin_count--;
+}
+
+// Next unpinned frame of a full ring, or -1 if every ring frame is pinned.
+static int buffer_ring_victim(buffer_part_t* part) {
+    int ring_size = part->ring.size();
+    for (int i = 0; i < ring_size; i++) {
+        int pos = (part->ring_next + i) % ring_size;
+        if (buffers[part->ring[pos]].pin_count == 0) {
+            part->ring_next = (pos + 1) % ring_size;
+            return part->ring[pos];
+        }
     }
     return -1;
 }
 
-int buffer_request_page(int64_t table_id, pagenum_t page_num) {
-    pthread_mutex_lock(&buffer_latch);
+// Moves a ring frame requested by a regular access into the replacer.
+static void buffer_leave_ring(buffer_part_t* part, int buffer_idx) {
+    for (int pos = 0; pos < (int)part->ring.size(); pos++) {
+        if (part->ring[pos] != buffer_idx) continue;
+        part->ring.erase(part->ring.begin() + pos);
+        if (part->ring_next > pos) part->ring_next--;
+        if (part->ring_next >= (int)part->ring.size()) part->ring_next = 0;
+        break;
+    }
+    buffers[buffer_idx].in_ring = 0;
+    part->replacer->insert(buffer_idx - part->base,
+                           buffers[buffer_idx].table_id, buffers[buffer_idx].page_num);
+}
 
-    int buffer_idx = buffer_get_buffer_idx(table_id, page_num);
-    if (buffer_idx != -1) {
-        if (buffers[buffer_idx] == NULL) {
-            buffers[buffer_idx] = new buffer_t;
-            buffers[buffer_idx]->is_dirty = 0;
-            buffers[buffer_idx]->page_latch = PTHREAD_MUTEX_INITIALIZER;
-            buffers[buffer_idx]->prev_LRU = NULL;
-            buffers[buffer_idx]->next_LRU = NULL;
-            buffers[buffer_idx]->table_id = table_id;
-            buffers[buffer_idx]->page_num = page_num;
-            file_read_page(table_id, page_num, &(buffers[buffer_idx]->frame));
-        }
-        pthread_mutex_lock(&(buffers[buffer_idx]->page_latch));
-    } else {
-        buffer_t* victim;
-        for (victim = buffers[buffer_get_first_LRU_idx()]; victim; victim = victim->next_LRU) {
-            if (pthread_mutex_trylock(&(victim->page_latch)) != EBUSY) break;
+/*
+ * Returns the frame holding the page, pinned and with its page latch held in
+ * `mode` (SHARED for read-only access, EXCLUSIVE for modification).
+ * Pins are only taken under the partition latch, so a frame with no pins can
+ * be evicted without looking at its latch. Reading the page and writing back
+ * a dirty victim are done after releasing the partition latch, while holding
+ * the latch of the frame involved, so that other requests for that frame
+ * wait on the frame alone.
+ * A hit on a page still being prefetched waits for that read.
+ * With SEQUENTIAL in `mode`, missed pages are read into the partition's ring
+ * of recycled frames instead of being handed to the replacer, and hits do
+ * not count as a reference, so a scan does not push out the working set.
+ */
+int buffer_request_page(int64_t table_id, pagenum_t page_num, int mode) {
+    buffer_part_t* part = buffer_get_part(table_id, page_num);
+    int slot = file_get_slot(table_id);
+    int sequential = (mode & SEQUENTIAL) != 0;
+    buffer_t* buffer;
+    int buffer_idx;
+
+    mode &= EXCLUSIVE;
+    while (true) {
+        buffer_lock_part(part);
+
+        auto it = part->page_table.find({table_id, page_num});
+        if (it != part->page_table.end()) {
+            buffer_idx = it->second;
+            buffers[buffer_idx].pin_count++;
+            // a prefetched page is usable once its read completes
+            while (buffers[buffer_idx].io_pending)
+                pthread_cond_wait(&(part->io_cond), &(part->part_latch));
+            buffer_count(part, slot, &buffer_stats_t::hits);
+            buffer_count_access(part, slot);
+            if (!sequential) {
+                if (buffers[buffer_idx].in_ring)
+                    buffer_leave_ring(part, buffer_idx);
+                else
+                    part->replacer->touch(buffer_idx - part->base);
+            }
+            buffer_ref_priority(&buffers[buffer_idx]);
+            pthread_mutex_unlock(&(part->part_latch));
+
+            buffer_latch_page(&buffers[buffer_idx], mode);
+            // the page may change, dropping the frames its swips refer to
+            if (mode == EXCLUSIVE && buffers[buffer_idx].swip_count != 0)
+                buffer_clear_swips(buffer_idx);
+            return buffer_idx;
         }
-        buffer_idx = buffer_get_buffer_idx(victim->table_id, victim->page_num);
-        if (buffers[buffer_idx]->is_dirty != 0) {
-            log_force();
-            file_write_page(buffers[buffer_idx]->table_id,
-                            buffers[buffer_idx]->page_num,
-                            &(buffers[buffer_idx]->frame));
-            buffers[buffer_idx]->is_dirty = 0;
-        }
-        buffers[buffer_idx]->table_id = table_id;
-        buffers[buffer_idx]->page_num = page_num;
-        file_read_page(table_id, page_num, &(buffers[buffer_idx]->frame));
-    }
-
-    if (buffers[buffer_idx]->prev_LRU != NULL)
-        buffers[buffer_idx]->prev_LRU->next_LRU = buffers[buffer_idx]->next_LRU;
-    if (buffers[buffer_idx]->next_LRU != NULL)
-        buffers[buffer_idx]->next_LRU->prev_LRU = buffers[buffer_idx]->prev_LRU;
-    buffers[buffer_idx]->next_LRU = buffers[buffer_idx];
-    buffers[buffer_idx]->prev_LRU = buffers[buffer_idx];
-    int last_LRU_idx = buffer_get_last_LRU_idx();
-    if (last_LRU_idx != -1) {
-        buffers[last_LRU_idx]->next_LRU = buffers[buffer_idx];
-        buffers[buffer_idx]->prev_LRU = buffers[last_LRU_idx];
-        buffers[buffer_idx]->next_LRU = NULL;
-    } else {
-        buffers[buffer_idx]->next_LRU = NULL;
-        buffers[buffer_idx]->prev_LRU = NULL;
+
+        int in_ring = sequential;
+        buffer_idx = -1;
+        if (sequential && (int)part->ring.size() == part->ring_size) {
+            buffer_idx = buffer_ring_victim(part);
+            in_ring = (buffer_idx != -1);
+        }
+        if (buffer_idx == -1 && part->used < part->size) {
+            buffer_idx = part->base + part->used++;
+            buffer = &buffers[buffer_idx];
+            buffer->in_ring = 0;
+            buffer->priority = 0;
+        } else {
+            if (buffer_idx == -1) {
+                int victim_idx = part->replacer->victim(buffer_try_evict, part);
+                // every frame may have just lost its second chance
+                if (victim_idx == -1 && swizzling)
+                    victim_idx = part->replacer->victim(buffer_try_evict, part);
+                // while a shrink waits on the frames it cuts, those left may
+                // all be pinned for a moment, e.g. by the cleaner
+                if (victim_idx == -1 && part->used > part->size) {
+                    pthread_mutex_unlock(&(part->part_latch));
+                    usleep(BUFFER_RESIZE_WAIT_US);
+                    continue;
+                }
+                if (victim_idx == -1)
+                    ERR_SYS("Failure to request page(every frame is pinned)");
+                buffer_idx = part->base + victim_idx;
+            }
+            buffer = &buffers[buffer_idx];
+            if (buffer->is_dirty != 0) {
+                // the cleaner fell behind, write back here and wake it up
+                buffer_write_victim(part, buffer);
+                pthread_cond_broadcast(&cleaner_cond);
+                continue;
+            }
+            buffer_count(part, file_get_slot(buffer->table_id), &buffer_stats_t::evictions);
+            part->page_table.erase({buffer->table_id, buffer->page_num});
+        }
+
+        // an unpinned frame has no latch holder, so this does not block
+        buffer->pin_count++;
+        pthread_rwlock_wrlock(&(buffer->page_latch));
+        buffer_begin_change(buffer);
+        buffer->table_id = table_id;
+        buffer->page_num = page_num;
+        part->page_table[{table_id, page_num}] = buffer_idx;
+        buffer_count(part, slot, &buffer_stats_t::misses);
+        buffer_count_access(part, slot);
+        if (!in_ring) {
+            part->replacer->insert(buffer_idx - part->base, table_id, page_num);
+        } else if (!buffer->in_ring) {
+            part->replacer->remove(buffer_idx - part->base);
+            part->ring.push_back(buffer_idx);
+        }
+        buffer->in_ring = in_ring;
+        pthread_mutex_unlock(&(part->part_latch));
+
+        file_read_page(table_id, page_num, buffer->frame);
+        if (mode == SHARED) {
+            // rwlocks cannot be downgraded, the pin keeps the page in place
+            buffer_unlatch_page(buffer);
+            buffer_latch_page(buffer, mode);
+        }
+        return buffer_idx;
     }
+}
 
-    pthread_mutex_unlock(&buffer_latch);
-    return buffer_idx;
+/*
+ * Starts reading the given pages in the background. Each page not resident
+ * gets a free or clean frame, marked pending and pinned until the prefetch
+ * workers have read it. Pages without such a frame, or beyond the share of
+ * the partition that may be pending at once, are skipped rather than writing
+ * anything back or starving regular requests. Returns the number of reads
+ * issued.
+ */
+int buffer_prefetch_pages(int64_t table_id, pagenum_t* page_nums, int n) {
+    std::vector<int> issued;
+    int slot = file_get_slot(table_id);
+
+    for (int i = 0; i < n; i++) {
+        buffer_part_t* part = buffer_get_part(table_id, page_nums[i]);
+        int buffer_idx;
+        buffer_lock_part(part);
+        if (part->page_table.find({table_id, page_nums[i]}) != part->page_table.end() ||
+            part->pending >= part->size / BUFFER_PREFETCH_SHARE) {
+            pthread_mutex_unlock(&(part->part_latch));
+            continue;
+        }
+        if (part->used < part->size) {
+            buffer_idx = part->base + part->used++;
+            buffers[buffer_idx].in_ring = 0;
+            buffers[buffer_idx].priority = 0;
+        } else {
+            int victim_idx = part->replacer->victim(buffer_try_evict_clean, part);
+            if (victim_idx == -1) {
+                pthread_mutex_unlock(&(part->part_latch));
+                continue;
+            }
+            buffer_idx = part->base + victim_idx;
+            buffer_count(part, file_get_slot(buffers[buffer_idx].table_id),
+                         &buffer_stats_t::evictions);
+            part->page_table.erase({buffers[buffer_idx].table_id, buffers[buffer_idx].page_num});
+        }
+
+        buffer_t* buffer = &buffers[buffer_idx];
+        buffer->pin_count++;
+        buffer->io_pending = 1;
+        buffer_begin_change(buffer);
+        part->pending++;
+        buffer->table_id = table_id;
+        buffer->page_num = page_nums[i];
+        part->page_table[{table_id, page_nums[i]}] = buffer_idx;
+        buffer_count(part, slot, &buffer_stats_t::misses);
+        buffer_count(part, slot, &buffer_stats_t::prefetches);
+        part->replacer->insert(buffer_idx - part->base, table_id, page_nums[i]);
+        pthread_mutex_unlock(&(part->part_latch));
+        issued.push_back(buffer_idx);
+    }
+
+    if (issued.empty()) return 0;
+    pthread_mutex_lock(&prefetch_latch);
+    prefetch_queue.insert(prefetch_queue.end(), issued.begin(), issued.end());
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_latch);
+    return issued.size();
 }
 
-pagenum_t buffer_alloc_page(int64_t table_id) {
-    pagenum_t page_num;
-    page_t *header, *alloc;
+/*
+ * Allocates `n` pages in a row, as close after `near` as there is room, in
+ * the bitmap pages of the table. The header stays latched for the search and
+ * serializes allocations; freeing only latches the bitmap page.
+ */
+pagenum_t buffer_alloc_pages(int64_t table_id, pagenum_t near, int n) {
+    page_t* header;
     buffer_read_page(table_id, 0, &header);
-    if (header->next_frpg == 0) {
-        file_write_page(table_id, 0, header);
-        page_num = file_alloc_page(table_id);
-        buffer_read_page(table_id, 0, &header);
+    pagenum_t num_pages = header->num_pages;
+    pagenum_t page_num = file_alloc_run(table_id, header, near, n,
+        [&](pagenum_t bitmap_num) {
+            page_t* bitmap;
+            buffer_read_page(table_id, bitmap_num, &bitmap);
+            return bitmap;
+        },
+        [&](pagenum_t bitmap_num, int changed) {
+            if (changed)
+                buffer_write_page(table_id, bitmap_num);
+            else
+                buffer_unpin_page(table_id, bitmap_num);
+        });
+    if (header->num_pages != num_pages)
+        buffer_write_page(table_id, 0);
+    else
         buffer_unpin_page(table_id, 0);
-        return page_num;
-    }
-    page_num = header->next_frpg;
-    buffer_read_page(table_id, page_num, &alloc);
-    header->next_frpg = alloc->next_frpg;
-    buffer_unpin_page(table_id, page_num);
-    buffer_write_page(table_id, 0);
     return page_num;
 }
 
+pagenum_t buffer_alloc_page(int64_t table_id, pagenum_t near) {
+    return buffer_alloc_pages(table_id, near, 1);
+}
+
 void buffer_free_page(int64_t table_id, pagenum_t page_num) {
-    page_t *header, *free;
-    buffer_read_page(table_id, 0, &header);
-    buffer_read_page(table_id, page_num, &free);
-    free->next_frpg = header->next_frpg;
-    header->next_frpg = page_num;
-    buffer_write_page(table_id, 0);
-    buffer_write_page(table_id, page_num);
+    pagenum_t bitmap_num = file_bitmap_page(page_num);
+    page_t* bitmap;
+    buffer_read_page(table_id, bitmap_num, &bitmap);
+    file_bitmap_mark(bitmap, page_num, 1, 0);
+    buffer_write_page(table_id, bitmap_num);
+
+    // a freed inner page may come back as a leaf
+    buffer_part_t* part = buffer_get_part(table_id, page_num);
+    buffer_lock_part(part);
+    auto it = part->page_table.find({table_id, page_num});
+    if (it != part->page_table.end() && buffers[it->second].priority)
+        buffer_leave_priority(part, it->second);
+    pthread_mutex_unlock(&(part->part_latch));
+}
+
+/*
+ * Pages of a table mapped by file_map_table_file() are not cached: they are
+ * returned in place, without pin or latch, and every release is a no-op.
+ * A SEQUENTIAL read of a mapped leaf has the kernel start on its sibling.
+ */
+static int buffer_is_frame(const page_t* page) {
+    return page >= frames && page < frames + (size_t)num_parts * part_capacity;
 }
 
-void buffer_read_page(int64_t table_id, pagenum_t page_num, page_t** dest) {
-    int buffer_idx = buffer_request_page(table_id, page_num);
-    *dest = &(buffers[buffer_idx]->frame);
+void buffer_read_page(int64_t table_id, pagenum_t page_num, page_t** dest, int mode) {
+    page_t* mapped = file_map_page(table_id, page_num);
+    if (mapped != NULL) {
+        if (mode & EXCLUSIVE)
+            ERR_SYS("Failure to read page(read-only table)");
+        if ((mode & SEQUENTIAL) && mapped->is_leaf && mapped->sibling != 0)
+            file_advise_page(table_id, mapped->sibling);
+        *dest = mapped;
+        return;
+    }
+    int buffer_idx = buffer_request_page(table_id, page_num, mode);
+    *dest = buffers[buffer_idx].frame;
 }
 
+/*
+ * Marks a page changed under its EXCLUSIVE latch dirty and releases it. A
+ * page becoming dirty joins the flush list with its page_LSN as rec_LSN:
+ * a logged change sets page_LSN before this, and a change that is not
+ * logged leaves an older page_LSN, which only holds recovery back longer.
+ */
 void buffer_write_page(int64_t table_id, pagenum_t page_num) {
-    int buffer_idx = buffer_get_buffer_idx(table_id, page_num);
-    buffers[buffer_idx]->is_dirty = 1;
-    pthread_mutex_unlock(&(buffers[buffer_idx]->page_latch));
+    buffer_part_t* part = buffer_get_part(table_id, page_num);
+    buffer_lock_part(part);
+    int buffer_idx = part->page_table.find({table_id, page_num})->second;
+    buffer_t* buffer = &buffers[buffer_idx];
+    if (buffer->is_dirty == 0) {
+        buffer->is_dirty = 1;
+        buffer->rec_LSN = buffer->frame->page_LSN;
+        part->flush_list.insert({buffer->rec_LSN, buffer_idx});
+    }
+    pthread_mutex_unlock(&(part->part_latch));
+    buffer_unlatch_page(buffer);
+    buffer->pin_count--;
 }
 
-void buffer_unpin_page(int64_t table_id, pagenum_t page_num) {
+/*
+ * Keeps a frame out of the replacer, with the latch held. Once the budget is
+ * full, kept frames are aged as by CLOCK: the hand clears the mark of frames
+ * used since it last passed them and hands the first unmarked one back to the
+ * replacer, its place going to the new frame.
+ */
+static void buffer_keep(buffer_part_t* part, int buffer_idx) {
+    buffer_t* buffer = &buffers[buffer_idx];
+    if (buffer->priority) {
+        buffer_ref_priority(buffer);
+        return;
+    }
+    if (buffer->in_ring || part->priority_size == 0)
+        return;
+    part->replacer->remove(buffer_idx - part->base);
+    buffer->priority = 1;
+    buffer->priority_ref = 0;
+    if ((int)part->priority.size() < part->priority_size) {
+        part->priority.push_back(buffer_idx);
+        return;
+    }
+
+    // frames marked again by optimistic readers behind the hand are not
+    // waited for past a second turn
+    int num_kept = part->priority.size();
+    int pos = part->priority_hand % num_kept;
+    for (int i = 0; i < 2 * num_kept && buffers[part->priority[pos]].priority_ref; i++) {
+        buffers[part->priority[pos]].priority_ref = 0;
+        pos = (pos + 1) % num_kept;
+    }
+    buffer_demote(part, part->priority[pos]);
+    part->priority[pos] = buffer_idx;
+    part->priority_hand = (pos + 1) % num_kept;
+}
+
+/*
+ * Releases a page read with buffer_read_page(). With PRIORITY in `hint`, the
+ * page (e.g. a header, root or inner node) is taken out of the replacer and
+ * kept resident, in place of the coldest kept page once the budget is full.
+ */
+void buffer_unpin_page(int64_t table_id, pagenum_t page_num, int hint) {
+    if (file_map_page(table_id, page_num) != NULL)
+        return;
+    buffer_part_t* part = buffer_get_part(table_id, page_num);
+    buffer_lock_part(part);
+    int buffer_idx = part->page_table.find({table_id, page_num})->second;
+    buffer_t* buffer = &buffers[buffer_idx];
+    if (hint & PRIORITY)
+        buffer_keep(part, buffer_idx);
+    pthread_mutex_unlock(&(part->part_latch));
+
+    buffer_unlatch_page(buffer);
+    buffer->pin_count--;
+}
+
+// Drops the pin of a frame no longer latched, applying an unpin `hint`.
+static void buffer_release(int buffer_idx, int hint) {
+    buffer_t* buffer = &buffers[buffer_idx];
+    if (hint & PRIORITY)
+        buffer_ref_priority(buffer);
+    if ((hint & PRIORITY) && !buffer->priority) {
+        buffer_part_t* part = &parts[buffer_idx / part_capacity];
+        buffer_lock_part(part);
+        buffer_keep(part, buffer_idx);
+        pthread_mutex_unlock(&(part->part_latch));
+    }
+    buffer->pin_count--;
+}
+
+/*
+ * buffer_unpin_page() for a page known by its frame, which needs no page
+ * table lookup and, unless a page is newly kept, no partition latch.
+ */
+void buffer_unpin_frame(page_t* page, int hint) {
+    if (!buffer_is_frame(page))
+        return;
+    int buffer_idx = page - frames;
+    buffer_unlatch_page(&buffers[buffer_idx]);
+    buffer_release(buffer_idx, hint);
+}
+
+/*
+ * Optimistic reads. buffer_peek_page() finds a resident page without pinning
+ * or latching it and returns the version of its frame; the copy of whatever
+ * was read from it is only consistent if buffer_validate() then succeeds.
+ * Frames are found through a direct-mapped table of hints, checked against
+ * the identity of the frame and refreshed from the page table on a miss.
+ * Returns -1 if the page is not resident, in which case the caller falls
+ * back to buffer_read_page(), or 1 if it is being changed.
+ */
+int buffer_peek_page(int64_t table_id, pagenum_t page_num, page_t** dest, uint64_t* version) {
+    page_t* mapped = file_map_page(table_id, page_num);
+    if (mapped != NULL) {
+        *dest = mapped;
+        *version = 0;
+        return 0;
+    }
+    std::atomic<int>* hint = &peek_hints[pair_hash()({table_id, page_num}) % BUFFER_PEEK_HINTS];
+    int buffer_idx = hint->load(std::memory_order_relaxed);
+    for (int i = 0; i < 2; i++) {
+        if (buffer_idx != -1) {
+            buffer_t* buffer = &buffers[buffer_idx];
+            *version = buffer->version.load(std::memory_order_acquire);
+            if (!(*version & 1) && buffer->table_id == table_id &&
+                buffer->page_num == page_num) {
+                *dest = buffer->frame;
+                buffer_ref_priority(buffer);
+                buffer_count_peek(table_id);
+                return 0;
+            }
+        }
+        if (i == 0) {
+            buffer_idx = buffer_get_buffer_idx(table_id, page_num);
+            if (buffer_idx == -1) return -1;
+            hint->store(buffer_idx, std::memory_order_relaxed);
+        }
+    }
+    return 1;
+}
+
+// Whether the frame of `page` is unchanged since buffer_peek_page().
+int buffer_validate(page_t* page, uint64_t version) {
+    if (!buffer_is_frame(page))
+        return 1;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return buffers[page - frames].version.load(std::memory_order_relaxed) == version;
+}
+
+/*
+ * Sets the swip of `slot` in a frame to its child `page_num`, both pinned,
+ * if the parent latch can be taken without waiting, the slot still refers to
+ * the child and the child is kept through PRIORITY.
+ */
+static void buffer_set_swip(int parent_idx, int slot, int buffer_idx, pagenum_t page_num) {
+    buffer_t* parent = &buffers[parent_idx];
+    buffer_t* buffer = &buffers[buffer_idx];
+    if (pthread_rwlock_tryrdlock(&(parent->page_latch)) != 0)
+        return;
+    page_t* frame = parent->frame;
+    pagenum_t child = slot ? frame->entries[slot - 1].child : frame->left_child;
+    int unset = -1;
+    if (!frame->is_leaf && slot <= (int)frame->num_keys && child == page_num &&
+        buffer->priority && buffer->swip_parent.compare_exchange_strong(unset, parent_idx)) {
+        buffer->swip_slot = slot;
+        swips[(size_t)parent_idx * BUFFER_SWIP_SLOTS + slot] = buffer_idx + 1;
+        parent->swip_count++;
+    }
+    pthread_rwlock_unlock(&(parent->page_latch));
+}
+
+/*
+ * Steps from an inner page read with buffer_read_page() to its child in
+ * `slot` (0 for left_child, i for entries[i - 1]), numbered `page_num`.
+ * `*page` is released as by buffer_unpin_frame() with `hint` and replaced by
+ * the child, latched in `mode`.
+ * With swizzling, a resident child is reached through the swip of the slot,
+ * pinned while the parent latch keeps the swip in place. Otherwise the child
+ * is read through the page table with the parent unlatched, since taking a
+ * child latch under a parent latch could deadlock with a modification
+ * latching them the other way. The parent stays pinned, and its swip is set
+ * if its latch can then be taken back without waiting and the slot still
+ * refers to the child. Only children kept through PRIORITY are swizzled:
+ * following a swip bypasses the replacer, which would otherwise lose track
+ * of how recently the child was used.
+ */
+void buffer_read_child(int64_t table_id, page_t** page, int slot, pagenum_t page_num,
+                       int mode, int hint) {
+    if (!buffer_is_frame(*page)) {
+        buffer_read_page(table_id, page_num, page, mode);
+        return;
+    }
+    int parent_idx = *page - frames;
+    buffer_t* parent = &buffers[parent_idx];
+    if (!swizzling) {
+        buffer_unpin_frame(*page, hint);
+        buffer_read_page(table_id, page_num, page, mode);
+        return;
+    }
+
+    std::atomic<int>* swip = &swips[(size_t)parent_idx * BUFFER_SWIP_SLOTS + slot];
+    int buffer_idx = *swip - 1;
+    if (buffer_idx != -1) {
+        buffer_t* buffer = &buffers[buffer_idx];
+        buffer->pin_count++;
+        buffer->swip_ref = 1;
+        buffer_ref_priority(buffer);
+        buffer_count_swip();
+        buffer_unpin_frame(*page, hint);
+        buffer_latch_page(buffer, mode & EXCLUSIVE);
+        if ((mode & EXCLUSIVE) && buffer->swip_count != 0)
+            buffer_clear_swips(buffer_idx);
+        *page = buffer->frame;
+        return;
+    }
+
+    pthread_rwlock_unlock(&(parent->page_latch));
+    buffer_idx = buffer_request_page(table_id, page_num, mode);
+    buffer_set_swip(parent_idx, slot, buffer_idx, page_num);
+    buffer_release(parent_idx, hint);
+    *page = buffers[buffer_idx].frame;
+}
+
+// Pins a frame unless it changed since buffer_peek_page() returned `version`.
+static int buffer_pin_peeked(int buffer_idx, uint64_t version) {
+    buffer_part_t* part = &parts[buffer_idx / part_capacity];
+    buffer_lock_part(part);
+    int pinned = buffers[buffer_idx].version == version;
+    if (pinned)
+        buffers[buffer_idx].pin_count++;
+    pthread_mutex_unlock(&(part->part_latch));
+    return pinned;
+}
+
+/*
+ * buffer_peek_page() for the child in `slot` of an inner page `parent`
+ * validated against `parent_version`, numbered `page_num`. With swizzling,
+ * the child is first looked for through the swip of the slot, checked
+ * against the identity of the frame it names since the swip may be cleared
+ * meanwhile. Otherwise the child is peeked through the hints and, if kept
+ * through PRIORITY, has its swip set as in buffer_read_child(), both frames
+ * being pinned for that under their partition latches.
+ */
+int buffer_peek_child(int64_t table_id, page_t* parent, uint64_t parent_version, int slot,
+                      pagenum_t page_num, page_t** dest, uint64_t* version) {
+    if (!swizzling || !buffer_is_frame(parent))
+        return buffer_peek_page(table_id, page_num, dest, version);
+    int parent_idx = parent - frames;
+    std::atomic<int>* swip = &swips[(size_t)parent_idx * BUFFER_SWIP_SLOTS + slot];
+    int buffer_idx = swip->load(std::memory_order_acquire) - 1;
+    if (buffer_idx != -1) {
+        buffer_t* buffer = &buffers[buffer_idx];
+        *version = buffer->version.load(std::memory_order_acquire);
+        if (!(*version & 1) && buffer->table_id == table_id &&
+            buffer->page_num == page_num) {
+            if (!buffer->swip_ref)
+                buffer->swip_ref = 1;
+            buffer_ref_priority(buffer);
+            buffer_count_swip();
+            buffer_count_peek(table_id);
+            *dest = buffer->frame;
+            return 0;
+        }
+    }
+
+    int ret = buffer_peek_page(table_id, page_num, dest, version);
+    if (ret != 0 || !buffer_is_frame(*dest))
+        return ret;
+    buffer_idx = *dest - frames;
+    buffer_t* buffer = &buffers[buffer_idx];
+    if (!buffer->priority || buffer->swip_parent != -1)
+        return 0;
+    if (buffer_pin_peeked(parent_idx, parent_version)) {
+        if (buffer_pin_peeked(buffer_idx, *version)) {
+            buffer_set_swip(parent_idx, slot, buffer_idx, page_num);
+            buffer_release(buffer_idx, 0);
+        }
+        buffer_release(parent_idx, 0);
+    }
+    return 0;
+}
+
+void buffer_pin_page(int64_t table_id, pagenum_t page_num) {
+    if (file_map_page(table_id, page_num) != NULL)
+        return;
+    buffer_part_t* part = buffer_get_part(table_id, page_num);
+    buffer_lock_part(part);
+    auto it = part->page_table.find({table_id, page_num});
+    if (it != part->page_table.end()) {
+        buffers[it->second].pin_count++;
+        pthread_mutex_unlock(&(part->part_latch));
+        return;
+    }
+    pthread_mutex_unlock(&(part->part_latch));
+
+    int buffer_idx = buffer_request_page(table_id, page_num, SHARED);
+    buffer_unlatch_page(&buffers[buffer_idx]);
+}
+
+void buffer_drop_pin(int64_t table_id, pagenum_t page_num) {
+    if (file_map_page(table_id, page_num) != NULL)
+        return;
     int buffer_idx = buffer_get_buffer_idx(table_id, page_num);
-    pthread_mutex_unlock(&(buffers[buffer_idx]->page_latch));
+    buffers[buffer_idx].pin_count--;
 }
 
 void buffer_flush() {
-    for (int i = 0; i < buffer_size; i++) {
-        if (buffers[i] != NULL && buffers[i]->is_dirty != 0)
-            file_write_page(buffers[i]->table_id, buffers[i]->page_num, &(buffers[i]->frame));
-        delete buffers[i];
-        buffers[i] = NULL;
+    buffer_stop_warmers();
+    buffer_stop_prefetcher();
+    buffer_stop_cleaner();
+    buffer_write_back();
+    for (int i = 0; i < num_parts; i++) {
+        pthread_mutex_lock(&(parts[i].part_latch));
+        parts[i].used = 0;
+        parts[i].page_table.clear();
+        parts[i].ring.clear();
+        parts[i].ring_next = 0;
+        parts[i].priority.clear();
+        parts[i].priority_hand = 0;
+        for (int j = parts[i].base; j < parts[i].base + parts[i].size; j++) {
+            buffer_begin_change(&buffers[j]);
+            buffers[j].table_id = -1;
+            buffer_end_change(&buffers[j]);
+            buffers[j].swip_parent = -1;
+            buffers[j].swip_count = 0;
+            buffers[j].swip_ref = 0;
+        }
+        delete parts[i].replacer;
+        parts[i].replacer = replacer_create(buffer_policy, parts[i].size);
+        pthread_mutex_unlock(&(parts[i].part_latch));
+    }
+    if (swizzling)
+        madvise(swips, (size_t)part_capacity * num_parts * BUFFER_SWIP_SLOTS * sizeof(int),
+                MADV_DONTNEED);
+    if (buffer_start_cleaner() != 0)
+        ERR_SYS("Failure to flush buffer(cleaner error)");
+    if (buffer_start_prefetcher() != 0)
+        ERR_SYS("Failure to flush buffer(prefetcher error)");
+    warmup_running = 1;
+}
+
+// Lowest rec_LSN of a dirty frame, or the log end if no frame is dirty.
+uint64_t buffer_get_min_rec_LSN() {
+    uint64_t min_LSN = log_get_LSN();
+    for (int i = 0; i < num_parts; i++) {
+        buffer_lock_part(&parts[i]);
+        if (!parts[i].flush_list.empty() && parts[i].flush_list.begin()->first < min_LSN)
+            min_LSN = parts[i].flush_list.begin()->first;
+        pthread_mutex_unlock(&(parts[i].part_latch));
+    }
+    return min_LSN;
+}
+
+/*
+ * Fuzzy checkpoint. Frames dirty since before the previous checkpoint began
+ * are written back oldest first, the log is forced, the tables are synced,
+ * and a CHECKPOINT record is forced with the LSN redo has to start from:
+ * the lowest rec_LSN, or the log end when the checkpoint began if lower.
+ * A change logged before that is made under the EXCLUSIVE latch of its
+ * page, which is only released once the page is dirty, so every frame
+ * latch is taken once in between. Not to be taken during recovery, whose
+ * pages are not dirty yet.
+ * Returns the redo LSN.
+ */
+uint64_t buffer_checkpoint() {
+    uint64_t begin_LSN = log_get_LSN();
+
+    for (int i = 0; i < num_parts; i++) {
+        buffer_part_t* part = &parts[i];
+        // frames left dirty are passed over, resuming after the last one seen
+        std::pair<uint64_t, int> last(0, -1);
+        int more = 1;
+        while (more) {
+            int dirty[2 * BUFFER_CLEANER_DEPTH];
+            int num_dirty = 0;
+            more = 0;
+            buffer_lock_part(part);
+            int quota = buffer_cleaner_quota(part);
+            for (auto it = part->flush_list.upper_bound(last);
+                 it != part->flush_list.end() && it->first < checkpoint_LSN; ++it) {
+                if (num_dirty == quota) {
+                    more = 1;
+                    break;
+                }
+                last = *it;
+                if (buffers[it->second].pin_count != 0) continue;
+                buffers[it->second].pin_count++;
+                dirty[num_dirty++] = it->second;
+            }
+            pthread_mutex_unlock(&(part->part_latch));
+            buffer_clean_frames(part, dirty, num_dirty);
+        }
+    }
+
+    pthread_mutex_lock(&resize_latch);
+    for (int i = 0; i < num_parts; i++) {
+        for (int j = parts[i].base; j < parts[i].base + parts[i].size; j++) {
+            pthread_rwlock_rdlock(&(buffers[j].page_latch));
+            pthread_rwlock_unlock(&(buffers[j].page_latch));
+        }
+    }
+    pthread_mutex_unlock(&resize_latch);
+
+    uint64_t redo_LSN = std::min(buffer_get_min_rec_LSN(), begin_LSN);
+    // the log goes first: synced pages must not be ahead of durable records
+    log_force();
+    // pages written back since the last sync may only be in the page cache
+    file_sync_table(FILE_ALL_TABLES);
+    log_write_log(redo_LSN, 0, CHECKPOINT);
+    log_force();
+    checkpoint_LSN = begin_LSN;
+    return redo_LSN;
+}
+
+// Has the cleaner take a checkpoint every `interval_ms`, or none if 0.
+void buffer_set_checkpoint(int interval_ms) {
+    checkpoint_interval_ms = interval_ms;
+    pthread_cond_broadcast(&cleaner_cond);
+}
+
+/*
+ * Cuts a partition down to `new_size` frames, called with its latch held.
+ * No frame at or beyond `new_size` is handed out once the size is lowered;
+ * those holding pages are then evicted from the top, waiting for their pins
+ * to drop and writing them back if dirty, before their memory is released.
+ */
+static void buffer_shrink_part(buffer_part_t* part, int new_size) {
+    int old_size = part->size;
+    part->size = new_size;
+    while (part->used > new_size) {
+        int buffer_idx = part->base + part->used - 1;
+        buffer_t* buffer = &buffers[buffer_idx];
+        if (buffer_unswizzle(buffer_idx) != 0 || buffer->pin_count != 0) {
+            pthread_mutex_unlock(&(part->part_latch));
+            usleep(BUFFER_RESIZE_WAIT_US);
+            buffer_lock_part(part);
+            continue;
+        }
+        if (buffer->is_dirty != 0) {
+            buffer_write_victim(part, buffer);
+            buffer_lock_part(part);
+            continue;
+        }
+        if (buffer->in_ring) {
+            buffer_leave_ring(part, buffer_idx);
+        } else if (buffer->priority) {
+            buffer_leave_priority(part, buffer_idx);
+        }
+        part->replacer->remove(buffer_idx - part->base);
+        buffer_count(part, file_get_slot(buffer->table_id), &buffer_stats_t::evictions);
+        part->page_table.erase({buffer->table_id, buffer->page_num});
+        buffer_begin_change(buffer);
+        buffer->table_id = -1;
+        buffer_end_change(buffer);
+        part->used--;
+    }
+
+    part->replacer->resize(new_size);
+    buffer_size_ring(part);
+    while ((int)part->ring.size() > part->ring_size) {
+        buffer_leave_ring(part, part->ring.back());
+    }
+    buffer_size_priority(part);
+    for (int i = part->base + new_size; i < part->base + old_size; i++) {
+        pthread_rwlock_destroy(&(buffers[i].page_latch));
+    }
+    madvise(&frames[part->base + new_size], (size_t)(old_size - new_size) * PAGE_SIZE,
+            MADV_DONTNEED);
+}
+
+/*
+ * Saves the resident pages to `path`, coldest first. Each partition lists its
+ * frames in the order its replacer would evict them, and the lists are merged
+ * by relative position. Pages in the sequential ring are left out.
+ */
+int buffer_save_resident(const char* path) {
+    std::vector<std::pair<double, buffer_resident_t>> resident;
+
+    for (int i = 0; i < num_parts; i++) {
+        buffer_part_t* part = &parts[i];
+        buffer_lock_part(part);
+        std::vector<int> order(part->size);
+        std::vector<char> listed(part->size, 0);
+        int num_order = part->replacer->candidates(order.data(), part->size);
+        for (int j = 0; j < num_order; j++) {
+            listed[order[j]] = 1;
+        }
+        // frames the replacer does not offer yet, e.g. referenced under CLOCK
+        for (int j = 0; j < part->used; j++) {
+            if (!listed[j]) order[num_order++] = j;
+        }
+        for (int j = 0; j < num_order; j++) {
+            buffer_t* buffer = &buffers[part->base + order[j]];
+            if (order[j] >= part->used || buffer->in_ring) continue;
+            resident.push_back({(double)j / num_order, {buffer->table_id, buffer->page_num}});
+        }
+        pthread_mutex_unlock(&(part->part_latch));
     }
-}
\ No newline at end of file
+    std::stable_sort(resident.begin(), resident.end(),
+                     [](const std::pair<double, buffer_resident_t>& a,
+                        const std::pair<double, buffer_resident_t>& b) {
+                         return a.first < b.first;
+                     });
+
+    // write aside and rename, so a crash never leaves a torn list behind
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE* fp = fopen(tmp_path.c_str(), "wb");
+    if (fp == NULL)
+        return -1;
+    for (const auto& entry : resident) {
+        if (fwrite(&(entry.second), sizeof(buffer_resident_t), 1, fp) != 1) {
+            fclose(fp);
+            return -1;
+        }
+    }
+    if (fclose(fp) != 0 || rename(tmp_path.c_str(), path) != 0)
+        return -1;
+    return resident.size();
+}
+
+/*
+ * Reads a list saved by buffer_save_resident(), keeping the hottest pages
+ * that fit in the buffer. They are prefetched as their tables are opened.
+ * Returns the number of pages kept, or -1 if there is no list.
+ */
+int buffer_load_resident(const char* path) {
+    std::vector<buffer_resident_t> resident;
+    buffer_resident_t entry;
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    while (fread(&entry, sizeof(buffer_resident_t), 1, fp) == 1) {
+        resident.push_back(entry);
+    }
+    fclose(fp);
+
+    size_t first = resident.size() > (size_t)buffer_size ? resident.size() - buffer_size : 0;
+    pthread_mutex_lock(&warmup_latch);
+    warmup_pages.clear();
+    for (size_t i = first; i < resident.size(); i++) {
+        warmup_pages[resident[i].table_id].push_back(resident[i].page_num);
+    }
+    pthread_mutex_unlock(&warmup_latch);
+    return resident.size() - first;
+}
+
+// Starts prefetching the loaded resident pages of a table just opened.
+void buffer_warm_table(int64_t table_id) {
+    pthread_mutex_lock(&warmup_latch);
+    auto it = warmup_pages.find(table_id);
+    if (it == warmup_pages.end() || !warmup_running) {
+        pthread_mutex_unlock(&warmup_latch);
+        return;
+    }
+    buffer_warmup_t* warmup = new buffer_warmup_t;
+    warmup->table_id = table_id;
+    warmup->page_nums.swap(it->second);
+    warmup_pages.erase(it);
+
+    pthread_t thread;
+    if (pthread_create(&thread, 0, buffer_warmer, warmup) != 0)
+        ERR_SYS("Failure to warm table(thread error)");
+    warmup_threads.push_back(thread);
+    pthread_mutex_unlock(&warmup_latch);
+}
+
+// Also saves the resident pages to `path` every `interval_ms`, 0 to stop.
+void buffer_set_resident_dump(const char* path, int interval_ms) {
+    pthread_mutex_lock(&cleaner_latch);
+    resident_path = path;
+    resident_interval_ms = interval_ms;
+    pthread_mutex_unlock(&cleaner_latch);
+}
+
+/*
+ * Grows or shrinks the buffer to `num_buf` frames while it is in use,
+ * spreading them over the partitions as init_buffer() does. Shrinking waits
+ * for pinned frames to be released. Returns -1 if `num_buf` does not fit the
+ * partitions or the address space reserved at init_buffer().
+ */
+int buffer_resize(int num_buf) {
+    if (num_buf < num_parts * BUFFER_PART_MIN_SIZE ||
+        num_buf / num_parts + 1 > part_capacity)
+        return -1;
+
+    pthread_mutex_lock(&resize_latch);
+    for (int i = 0; i < num_parts; i++) {
+        int new_size = num_buf / num_parts + (i < num_buf % num_parts);
+        buffer_lock_part(&parts[i]);
+        if (new_size > parts[i].size) {
+            if (buffer_grow_part(&parts[i], new_size) != 0)
+                ERR_SYS("Failure to resize buffer(latch error)");
+        } else if (new_size < parts[i].size) {
+            buffer_shrink_part(&parts[i], new_size);
+        }
+        pthread_mutex_unlock(&(parts[i].part_latch));
+    }
+    buffer_size = num_buf;
+    pthread_mutex_unlock(&resize_latch);
+    return 0;
+}
+
+/*
+ * Sets how many frames in total may be kept resident through PRIORITY,
+ * -1 for 1/BUFFER_PRIORITY_SHARE of each partition. Each partition keeps at
+ * most half of its frames.
+ */
+void buffer_set_priority_budget(int num_frames) {
+    pthread_mutex_lock(&resize_latch);
+    priority_budget = num_frames;
+    for (int i = 0; i < num_parts; i++) {
+        buffer_lock_part(&parts[i]);
+        buffer_size_priority(&parts[i]);
+        pthread_mutex_unlock(&(parts[i].part_latch));
+    }
+    pthread_mutex_unlock(&resize_latch);
+}
+
+/*
+ * Keeps the pages of a table in the partitions of NUMA node `node`, e.g. the
+ * node of the threads serving it. Must be called before the table is opened:
+ * returns -1 if it already has pages in the buffer, if the node has no
+ * partition or if too many tables are bound.
+ */
+int buffer_set_table_node(int64_t table_id, int node) {
+    if (node < 0 || node >= num_nodes || node_num_parts[node] == 0)
+        return -1;
+    pthread_mutex_lock(&resize_latch);
+    int slot = file_get_slot(table_id);
+    for (int i = 0; i < num_parts && slot != -1; i++) {
+        pthread_mutex_lock(&(parts[i].part_latch));
+        int used = parts[i].table_stats[slot].misses != 0;
+        pthread_mutex_unlock(&(parts[i].part_latch));
+        if (used) {
+            pthread_mutex_unlock(&resize_latch);
+            return -1;
+        }
+    }
+    int n = num_affinities;
+    int i = 0;
+    while (i < n && affinities[i].table_id != table_id) i++;
+    if (i == BUFFER_MAX_AFFINITIES) {
+        pthread_mutex_unlock(&resize_latch);
+        return -1;
+    }
+    affinities[i].table_id = table_id;
+    affinities[i].node = node;
+    if (i == n)
+        num_affinities.store(n + 1, std::memory_order_release);
+    pthread_mutex_unlock(&resize_latch);
+    return 0;
+}
+
+/*
+ * Sums the counters of every partition into `dest`, for one table or for
+ * BUFFER_ALL_TABLES. Latch wait histograms are only filled in for the latter.
+ */
+int buffer_get_stats(int64_t table_id, buffer_stats_t* dest) {
+    memset(dest, 0, sizeof(buffer_stats_t));
+    int slot = table_id != BUFFER_ALL_TABLES ? file_get_slot(table_id) : -1;
+    for (int i = 0; i < num_parts; i++) {
+        buffer_stats_t* src = &(parts[i].stats);
+        pthread_mutex_lock(&(parts[i].part_latch));
+        if (table_id != BUFFER_ALL_TABLES)
+            src = slot != -1 ? &(parts[i].table_stats[slot]) : NULL;
+        if (src != NULL) {
+            dest->hits += src->hits;
+            dest->misses += src->misses;
+            dest->evictions += src->evictions;
+            dest->fg_flushes += src->fg_flushes;
+            dest->bg_flushes += src->bg_flushes;
+            dest->prefetches += src->prefetches;
+            dest->local += src->local;
+            dest->remote += src->remote;
+        }
+        if (table_id == BUFFER_ALL_TABLES) {
+            for (int j = 0; j < BUFFER_WAIT_BUCKETS; j++) {
+                dest->part_waits[j] += src->part_waits[j];
+                dest->page_waits[j] += parts[i].page_waits[j];
+            }
+        }
+        pthread_mutex_unlock(&(parts[i].part_latch));
+    }
+
+    pthread_mutex_lock(&thread_counts_latch);
+    for (buffer_thread_counts_t* counts : thread_counts) {
+        if (table_id == BUFFER_ALL_TABLES) {
+            dest->hits += counts->hits.load(std::memory_order_relaxed);
+            dest->swip_hits += counts->swip_hits.load(std::memory_order_relaxed);
+        } else if (slot != -1)
+            dest->hits += counts->table_hits[slot].load(std::memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&thread_counts_latch);
+    return 0;
+}
+
+static void buffer_dump_counters(FILE* fp, const char* name, buffer_stats_t* stats) {
+    fprintf(fp, "[BUFFER] %s hits %lu misses %lu evictions %lu fg_flushes %lu "
+            "bg_flushes %lu prefetches %lu local %lu remote %lu\n", name, stats->hits,
+            stats->misses, stats->evictions, stats->fg_flushes, stats->bg_flushes,
+            stats->prefetches, stats->local, stats->remote);
+}
+
+static void buffer_dump_waits(FILE* fp, const char* name, uint64_t* waits) {
+    fprintf(fp, "[BUFFER] %s latch waits(us):", name);
+    for (int i = 0; i < BUFFER_WAIT_BUCKETS; i++) {
+        if (waits[i] != 0) fprintf(fp, " <%lu:%lu", 2UL << i, waits[i]);
+    }
+    fprintf(fp, "\n");
+}
+
+void buffer_dump_stats(FILE* fp) {
+    buffer_stats_t stats;
+    char name[32];
+
+    buffer_get_stats(BUFFER_ALL_TABLES, &stats);
+    buffer_dump_counters(fp, "all", &stats);
+    if (swizzling)
+        fprintf(fp, "[BUFFER] all swip_hits %lu\n", stats.swip_hits);
+    buffer_dump_waits(fp, "partition", stats.part_waits);
+    buffer_dump_waits(fp, "page", stats.page_waits);
+
+    for (int slot = 0; slot < FILE_MAX_TABLES; slot++) {
+        int64_t table_id = file_get_slot_table(slot);
+        if (table_id == 0) continue;
+        buffer_get_stats(table_id, &stats);
+        sprintf(name, "table %ld", table_id);
+        buffer_dump_counters(fp, name, &stats);
+    }
+    fflush(fp);
+}
+
+// Dumps the statistics to `fp` every `interval_ms`, or stops with NULL.
+void buffer_set_stats_dump(FILE* fp, int interval_ms) {
+    pthread_mutex_lock(&cleaner_latch);
+    stats_fp = fp;
+    stats_interval_ms = interval_ms;
+    pthread_mutex_unlock(&cleaner_latch);
+}
+
+void buffer_get_hit_stats(uint64_t* hits, uint64_t* misses) {
+    buffer_stats_t stats;
+    buffer_get_stats(BUFFER_ALL_TABLES, &stats);
+    *hits = stats.hits;
+    *misses = stats.misses;
+}
+
+void buffer_get_flush_stats(uint64_t* fg, uint64_t* bg) {
+    buffer_stats_t stats;
+    buffer_get_stats(BUFFER_ALL_TABLES, &stats);
+    *fg = stats.fg_flushes;
+    *bg = stats.bg_flushes;
+}
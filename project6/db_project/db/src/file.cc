@@ -2,142 +2,582 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <regex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
-#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <vector>
 
-static std::unordered_map<int64_t, int> tables;
-static int fds[20];
-static int idx;
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
 
-int64_t file_open_table_file(const char* pathname) {
+/*
+ * Page I/O is positional, so any number of threads may read and write pages
+ * of the same table at once. Open tables take slots in `slots`, which are
+ * filled in under `tables_latch` and published by storing the table id and
+ * then `num_tables`, so that lookups need no latch. Slots are only emptied
+ * by file_close_table_file(), with no page I/O going on.
+ *
+ * Tables opened with file_map_table_file() are mapped read-only in whole and
+ * read in place through file_map_page(); `num_maps` lets the lookup return
+ * at once while no table is mapped.
+ */
+struct file_table_t {
+    std::atomic<int64_t> table_id;
+    int fd;
+    page_t* map;            // pages of a mapped table, or NULL
+    pagenum_t map_pages;
+};
+static file_table_t slots[FILE_MAX_TABLES];
+static std::atomic<int> num_tables;
+static std::atomic<int> num_maps;
+static pthread_mutex_t tables_latch = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * With direct I/O, table files are opened with O_DIRECT so that pages are
+ * only cached in the buffer. Every transfer is then a whole number of pages
+ * at a page offset, from memory aligned to PAGE_SIZE: buffer frames and the
+ * pages of the file layer are, and file_read_page()/file_write_page() copy
+ * other pages through `bounce`.
+ */
+static int direct_io;
+alignas(PAGE_SIZE) static thread_local page_t bounce;
+
+/*
+ * Slot of an open table, below FILE_MAX_TABLES, or -1. A table keeps its
+ * slot until file_close_table_file().
+ */
+int file_get_slot(int64_t table_id) {
+    int n = num_tables.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        if (slots[i].table_id.load(std::memory_order_acquire) == table_id)
+            return i;
+    }
+    return -1;
+}
+
+// Table in slot `slot`, or 0 if the slot is free.
+int64_t file_get_slot_table(int slot) {
+    if (slot >= num_tables.load(std::memory_order_acquire))
+        return 0;
+    return slots[slot].table_id.load(std::memory_order_acquire);
+}
+
+// File descriptor of an open table, or -1.
+static int file_get_fd(int64_t table_id) {
+    int slot = file_get_slot(table_id);
+    return slot != -1 ? slots[slot].fd : -1;
+}
+
+// Drops the first `done` bytes of `*n` buffers at `*iov`.
+static void file_iov_advance(struct iovec** iov, int* n, size_t done) {
+    while (*n > 0 && done >= (*iov)->iov_len) {
+        done -= (*iov)->iov_len;
+        (*iov)++;
+        (*n)--;
+    }
+    if (*n > 0) {
+        (*iov)->iov_base = (char*)(*iov)->iov_base + done;
+        (*iov)->iov_len -= done;
+    }
+}
+
+/*
+ * Reads or writes the `n` buffers of `iov` from `offset` on, consuming
+ * `iov`. Short transfers are resumed.
+ */
+static int file_transfer(int fd, off_t offset, struct iovec* iov, int n, int write) {
+    while (n > 0) {
+        int cnt = n < IOV_MAX ? n : IOV_MAX;
+        ssize_t done = write ? pwritev(fd, iov, cnt, offset) : preadv(fd, iov, cnt, offset);
+        if (done <= 0)
+            return -1;
+        offset += done;
+        file_iov_advance(&iov, &n, done);
+    }
+    return 0;
+}
+
+/*
+ * Reserves the pages [first, end) on disk in one call, so that writing them
+ * later neither fails for space nor fragments the file. File systems without
+ * fallocate() get a sparse file.
+ */
+static int file_reserve(int fd, pagenum_t first, pagenum_t end) {
+    off_t offset = first * PAGE_SIZE, len = (end - first) * PAGE_SIZE;
+    if (fallocate(fd, 0, offset, len) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP)
+        return -1;
+    return ftruncate(fd, offset + len);
+}
+
+// Table id of a table file not open yet.
+static int64_t file_table_id(const char* pathname) {
     if (!std::regex_match(pathname, std::regex("DATA[1-9][0-9]*")))
         ERR_SYS("Failure to open table file(invalid filename)");
-    if (tables[atol(pathname + 4)] != 0)
+    int64_t table_id = atol(pathname + 4);
+    if (file_get_fd(table_id) != -1)
+        ERR_SYS("Failure to open table file(already open file)");
+    return table_id;
+}
+
+/*
+ * Whether an existing table file has bitmap pages. Files from before them
+ * chain free pages through the pages themselves and use page 1, where the
+ * first bitmap page now lives, for data, so they cannot be converted in
+ * place. Returns -1 for those.
+ */
+static int file_check_format(int fd) {
+    alignas(PAGE_SIZE) page_t header;
+    if (pread(fd, &header, PAGE_SIZE, 0) != PAGE_SIZE)
+        ERR_SYS("Failure to open table file(read error)");
+    return header.magic == FILE_MAGIC ? 0 : -1;
+}
+
+static void file_add_table(int64_t table_id, int fd, page_t* map, pagenum_t map_pages) {
+    pthread_mutex_lock(&tables_latch);
+    int n = num_tables.load(std::memory_order_relaxed);
+    if (file_get_slot(table_id) != -1)
         ERR_SYS("Failure to open table file(already open file)");
+    if (n == FILE_MAX_TABLES)
+        ERR_SYS("Failure to open table file(too many tables)");
+    slots[n].fd = fd;
+    slots[n].map = map;
+    slots[n].map_pages = map_pages;
+    slots[n].table_id.store(table_id, std::memory_order_release);
+    num_tables.store(n + 1, std::memory_order_release);
+    if (map != NULL)
+        num_maps++;
+    pthread_mutex_unlock(&tables_latch);
+}
 
-    int fd = open(pathname, O_RDWR | O_CREAT, 0644);
+int64_t file_open_table_file(const char* pathname) {
+    int64_t table_id = file_table_id(pathname);
+
+    int fd = open(pathname, O_RDWR | O_CREAT | (direct_io ? O_DIRECT : 0), 0644);
+    // a file system without direct I/O keeps the page cache
+    if (fd < 0 && direct_io && errno == EINVAL)
+        fd = open(pathname, O_RDWR | O_CREAT, 0644);
     if (fd < 0)
         ERR_SYS("Failure to open table file(open error)");
-    
+
     if (lseek(fd, 0, SEEK_END) == 0) {
-        page_t header;
-        header.next_frpg = INITIAL_PAGENUM - 1;
+        alignas(PAGE_SIZE) page_t header;
+        memset(&header, 0, PAGE_SIZE);
         header.num_pages = INITIAL_PAGENUM;
         header.root_num = 0;
-        lseek(fd, 0, SEEK_SET);
-        if (write(fd, &header, PAGE_SIZE) != PAGE_SIZE)
+        header.magic = FILE_MAGIC;
+        if (file_reserve(fd, 1, INITIAL_PAGENUM) != 0)
+            ERR_SYS("Failure to open table file(fallocate error)");
+        if (pwrite(fd, &header, PAGE_SIZE, 0) != PAGE_SIZE)
             ERR_SYS("Failure to open table file(write error)");
         fsync(fd);
-
-        page_t p;
-        for (int i = 1; i < INITIAL_PAGENUM; i++) {
-            p.next_frpg = i - 1;
-            if (write(fd, &p, PAGE_SIZE) != PAGE_SIZE)
-                ERR_SYS("Failure to open table file(write error)");
-        }
-        fsync(fd);
+    } else if (file_check_format(fd) != 0) {
+        close(fd);
+        return -1;
     }
 
-    int64_t table_id = atol(pathname + 4);
-    tables[table_id] = fd;
-    fds[idx++] = fd;
+    file_add_table(table_id, fd, NULL, 0);
     return table_id;
 }
 
-pagenum_t file_alloc_page(int64_t table_id) {
-    int fd = tables[table_id];
+/*
+ * Opens an existing table file read-only and maps its pages. Lookups jump
+ * around the file, so the kernel is told not to read ahead; scans ask for
+ * the leaves they go to next with file_advise_page().
+ */
+int64_t file_map_table_file(const char* pathname) {
+    int64_t table_id = file_table_id(pathname);
+    int fd = open(pathname, O_RDONLY);
+    if (fd < 0)
+        ERR_SYS("Failure to map table file(open error)");
 
-    page_t header;
-    lseek(fd, 0, SEEK_SET);
-    if (read(fd, &header, PAGE_SIZE) != PAGE_SIZE)
-        ERR_SYS("Failure to alloc page(read error)");
+    if (file_check_format(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    alignas(PAGE_SIZE) page_t header;
+    if (pread(fd, &header, PAGE_SIZE, 0) != PAGE_SIZE)
+        ERR_SYS("Failure to map table file(read error)");
 
-    pagenum_t page_num;
-    if (header.next_frpg == 0) {
-        page_num = header.num_pages;
-
-        page_t p;
-        p.next_frpg = 0;
-        lseek(fd, page_num * PAGE_SIZE, SEEK_SET);
-        if (write(fd, &p, PAGE_SIZE) != PAGE_SIZE)
-            ERR_SYS("Failure to alloc page(write error)");
-        fsync(fd);
+    size_t len = header.num_pages * PAGE_SIZE;
+    void* addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        ERR_SYS("Failure to map table file(mmap error)");
+    madvise(addr, len, MADV_RANDOM);
 
-        pagenum_t i;
-        for (i = page_num + 1; i < 2 * page_num; i++) {
-            p.next_frpg = i - 1;
-            if (write(fd, &p, PAGE_SIZE) != PAGE_SIZE)
-                ERR_SYS("Failure to alloc page(write error)");
-        }
-        fsync(fd);
+    file_add_table(table_id, fd, (page_t*)addr, header.num_pages);
+    return table_id;
+}
 
-        header.next_frpg = i - 1;
-        header.num_pages = i;
-    }
-    page_num = header.next_frpg;
+// Page `page_num` of a mapped table in place, or NULL for other tables.
+page_t* file_map_page(int64_t table_id, pagenum_t page_num) {
+    if (num_maps.load(std::memory_order_relaxed) == 0)
+        return NULL;
+    int slot = file_get_slot(table_id);
+    if (slot == -1 || slots[slot].map == NULL)
+        return NULL;
+    if (page_num >= slots[slot].map_pages)
+        ERR_SYS("Failure to read page(page out of mapped file)");
+    return &slots[slot].map[page_num];
+}
 
-    page_t alloc;
-    lseek(fd, page_num * PAGE_SIZE, SEEK_SET);
-    if (read(fd, &alloc, PAGE_SIZE) != PAGE_SIZE)
-        ERR_SYS("Failure to alloc page(read error)");
+// Starts reading a page of a mapped table that is about to be used.
+void file_advise_page(int64_t table_id, pagenum_t page_num) {
+    page_t* page = file_map_page(table_id, page_num);
+    if (page != NULL)
+        madvise(page, PAGE_SIZE, MADV_WILLNEED);
+}
 
-    header.next_frpg = alloc.next_frpg;
-    lseek(fd, 0, SEEK_SET);
-    if (write(fd, &header, PAGE_SIZE) != PAGE_SIZE)
-        ERR_SYS("Failure to alloc page(write error)");
-    fsync(fd);
+/*
+ * Free pages are tracked by bitmap pages, one bit per page. The pages of a
+ * table fall into groups of FILE_BITMAP_BITS, and the second page of each
+ * group is its bitmap page. The header and the bitmap pages are never free,
+ * so their bits are not used, and a bitmap page of zeros, as fallocate()
+ * leaves it, has every other page of its group free.
+ */
+pagenum_t file_bitmap_page(pagenum_t page_num) {
+    return page_num / FILE_BITMAP_BITS * FILE_BITMAP_BITS + 1;
+}
 
-    return page_num;
+// Whether the page at `bit` of the group starting at `first` is in use.
+static int file_bitmap_used(const page_t* bitmap, pagenum_t first, uint64_t bit) {
+    if (bit == 1 || (first == 0 && bit == 0))
+        return 1;
+    return (bitmap->bitmap[bit / 64] >> (bit % 64)) & 1;
 }
 
-void file_free_page(int64_t table_id, pagenum_t page_num) {
-    int fd = tables[table_id];
+/*
+ * Finds `n` free pages in a row at bits [from, end) of the group starting at
+ * `first`, skipping full words, and returns the bit of the first one or -1.
+ */
+static int64_t file_bitmap_find(const page_t* bitmap, pagenum_t first,
+                                uint64_t from, uint64_t end, int n) {
+    int run = 0;
+    for (uint64_t bit = from; bit < end; bit++) {
+        if (bit % 64 == 0 && bitmap->bitmap[bit / 64] == ~0ULL) {
+            run = 0;
+            bit += 63;
+        } else if (file_bitmap_used(bitmap, first, bit)) {
+            run = 0;
+        } else if (++run == n) {
+            return bit - n + 1;
+        }
+    }
+    return -1;
+}
 
-    page_t header;
-    lseek(fd, 0, SEEK_SET);
-    if (read(fd, &header, PAGE_SIZE) != PAGE_SIZE)
-        ERR_SYS("Failure to free page(read error)");
+// Marks the `n` pages from `page_num` on, all in the group of `bitmap`.
+void file_bitmap_mark(page_t* bitmap, pagenum_t page_num, int n, int used) {
+    for (pagenum_t bit = page_num % FILE_BITMAP_BITS; n > 0; bit++, n--) {
+        if (used)
+            bitmap->bitmap[bit / 64] |= 1ULL << (bit % 64);
+        else
+            bitmap->bitmap[bit / 64] &= ~(1ULL << (bit % 64));
+    }
+}
+
+/*
+ * Allocates `n` pages in a row within one group and returns the first. The
+ * search starts at `near`, so that a page lands close to a related one, and
+ * goes on through the rest of its group and the other groups. With no room
+ * left, the file doubles with one fallocate() and the run comes from the new
+ * half; its bitmap pages are left zero, i.e. free.
+ *
+ * The caller holds `header` exclusively and writes it back; `get_bitmap`
+ * returns a bitmap page to change and `put_bitmap` releases it, marked
+ * changed or not.
+ */
+pagenum_t file_alloc_run(int64_t table_id, page_t* header, pagenum_t near, int n,
+                         const std::function<page_t*(pagenum_t)>& get_bitmap,
+                         const std::function<void(pagenum_t, int)>& put_bitmap) {
+    if (n < 1 || n > FILE_BITMAP_BITS - 2)
+        ERR_SYS("Failure to alloc page(invalid run length)");
 
-    page_t free;
-    free.next_frpg = header.next_frpg;
-    lseek(fd, page_num * PAGE_SIZE, SEEK_SET);
-    if (write(fd, &free, PAGE_SIZE) != PAGE_SIZE)
-        ERR_SYS("Failure to free page(write error)");
-    fsync(fd);
+    for (;;) {
+        pagenum_t num_pages = header->num_pages;
+        pagenum_t num_groups = (num_pages + FILE_BITMAP_BITS - 1) / FILE_BITMAP_BITS;
+        pagenum_t start = near < num_pages ? near : 0;
+        for (pagenum_t i = 0; i < num_groups; i++) {
+            pagenum_t first = (start / FILE_BITMAP_BITS + i) % num_groups * FILE_BITMAP_BITS;
+            uint64_t end = std::min<pagenum_t>(num_pages - first, FILE_BITMAP_BITS);
+            uint64_t from = i == 0 ? start - first : 0;
 
-    header.next_frpg = page_num;
-    lseek(fd, 0, SEEK_SET);
-    if (write(fd, &header, PAGE_SIZE) != PAGE_SIZE)
-        ERR_SYS("Failure to free page(write error)");
-    fsync(fd);
+            page_t* bitmap = get_bitmap(first + 1);
+            int64_t bit = file_bitmap_find(bitmap, first, from, end, n);
+            if (bit < 0 && from > 0)
+                bit = file_bitmap_find(bitmap, first, 0, std::min<uint64_t>(from + n - 1, end), n);
+            if (bit >= 0) {
+                file_bitmap_mark(bitmap, first + bit, n, 1);
+                put_bitmap(first + 1, 1);
+                return first + bit;
+            }
+            put_bitmap(first + 1, 0);
+        }
+
+        if (file_reserve(file_get_fd(table_id), num_pages, 2 * num_pages) != 0)
+            ERR_SYS("Failure to alloc page(fallocate error)");
+        header->num_pages = 2 * num_pages;
+        near = num_pages;
+    }
 }
 
 void file_read_page(int64_t table_id, pagenum_t page_num, page_t* dest) {
-    int fd = tables[table_id];
+    int fd = file_get_fd(table_id);
+    int unaligned = direct_io && ((uintptr_t)dest & (PAGE_SIZE - 1));
 
-    lseek(fd, page_num * PAGE_SIZE, SEEK_SET);
-    if (read(fd, dest, PAGE_SIZE) != PAGE_SIZE)
+    if (pread(fd, unaligned ? &bounce : dest, PAGE_SIZE, page_num * PAGE_SIZE) != PAGE_SIZE)
         ERR_SYS("Failure to read page(read error)");
+    if (unaligned)
+        memcpy(dest, &bounce, PAGE_SIZE);
 }
 
 void file_write_page(int64_t table_id, pagenum_t page_num, const page_t* src) {
-    int fd = tables[table_id];
+    int fd = file_get_fd(table_id);
 
-    lseek(fd, page_num * PAGE_SIZE, SEEK_SET);
-    if (write(fd, src, PAGE_SIZE) != PAGE_SIZE)
+    if (direct_io && ((uintptr_t)src & (PAGE_SIZE - 1))) {
+        memcpy(&bounce, src, PAGE_SIZE);
+        src = &bounce;
+    }
+    if (pwrite(fd, src, PAGE_SIZE, page_num * PAGE_SIZE) != PAGE_SIZE)
         ERR_SYS("Failure to write page(write error)");
-    fsync(fd);
+}
+
+// consecutive pages of a batch moved by one vectored call
+struct file_run_t {
+    int fd;
+    pagenum_t page_num;
+    int write;
+    int first;  // first iovec of the run
+    int n;
+};
+
+#ifdef USE_IO_URING
+/*
+ * io_uring instance of a thread, set up on its first batch and used without
+ * liburing. A thread where the kernel refuses it, e.g. under a seccomp
+ * policy, keeps to the synchronous calls.
+ */
+struct file_ring_t {
+    int fd = -1;
+    int failed = 0;
+    void* sq_ptr = MAP_FAILED;
+    void* cq_ptr = MAP_FAILED;
+    size_t sq_len = 0;
+    size_t cq_len = 0;
+    size_t sqes_len = 0;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes = (struct io_uring_sqe*)MAP_FAILED;
+    struct io_uring_cqe* cqes;
+
+    ~file_ring_t() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+        if (fd >= 0) close(fd);
+    }
+};
+
+static thread_local file_ring_t ring;
+
+static int file_ring_setup(file_ring_t* r) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    r->fd = syscall(__NR_io_uring_setup, FILE_URING_DEPTH, &params);
+    if (r->fd < 0)
+        return -1;
+    r->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_len = r->cq_len = std::max(r->sq_len, r->cq_len);
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        return -1;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            return -1;
+    }
+    r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+    char* sq = (char*)r->sq_ptr;
+    char* cq = (char*)r->cq_ptr;
+    r->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + params.sq_off.array);
+    r->cq_head = (unsigned*)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/*
+ * Moves the runs through the ring of the calling thread, keeping up to
+ * FILE_URING_DEPTH of them in flight. A run the kernel cuts short is
+ * finished synchronously. Returns -1 if the thread has no ring.
+ */
+static int file_ring_submit(file_run_t* runs, int num_runs, struct iovec* iov) {
+    file_ring_t* r = &ring;
+    if (r->fd < 0 && !r->failed && file_ring_setup(r) != 0)
+        r->failed = 1;
+    if (r->failed)
+        return -1;
+
+    int next = 0, in_flight = 0, completed = 0;
+    unsigned to_submit = 0;
+    while (completed < num_runs) {
+        unsigned tail = *r->sq_tail;
+        while (next < num_runs && in_flight < FILE_URING_DEPTH) {
+            file_run_t* run = &runs[next];
+            unsigned slot = tail & *r->sq_mask;
+            struct io_uring_sqe* sqe = &r->sqes[slot];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = run->write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = run->fd;
+            sqe->addr = (uint64_t)(uintptr_t)&iov[run->first];
+            sqe->len = run->n;
+            sqe->off = run->page_num * PAGE_SIZE;
+            sqe->user_data = next;
+            r->sq_array[slot] = slot;
+            tail++;
+            next++;
+            in_flight++;
+            to_submit++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+        int ret = syscall(__NR_io_uring_enter, r->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR)
+            ERR_SYS("Failure to submit io(io_uring_enter error)");
+        if (ret > 0)
+            to_submit -= ret;
+
+        unsigned head = *r->cq_head;
+        unsigned cq_tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+            file_run_t* run = &runs[cqe->user_data];
+            if (cqe->res <= 0) {
+                errno = -cqe->res;
+                ERR_SYS("Failure to submit io(io error)");
+            }
+            struct iovec* rest = &iov[run->first];
+            int n = run->n;
+            file_iov_advance(&rest, &n, cqe->res);
+            if (n > 0 && file_transfer(run->fd, run->page_num * PAGE_SIZE + cqe->res,
+                                       rest, n, run->write) != 0)
+                ERR_SYS("Failure to submit io(io error)");
+            in_flight--;
+            completed++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Reads and writes a batch of pages. Consecutive pages of a table moving
+ * the same way are merged into runs of up to FILE_IO_BATCH pages, which are
+ * kept in flight together through io_uring when built with USE_IO_URING and
+ * the kernel allows it, and otherwise moved one run at a time with
+ * preadv/pwritev. Returns once every page is done, in no particular order.
+ * With direct I/O, pages not aligned to PAGE_SIZE are moved on their own.
+ */
+void file_submit_io(file_io_t* ios, int n) {
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [ios](int a, int b) {
+        if (ios[a].table_id != ios[b].table_id) return ios[a].table_id < ios[b].table_id;
+        return ios[a].page_num < ios[b].page_num;
+    });
+
+    std::vector<struct iovec> iov(n);
+    std::vector<file_run_t> runs;
+    for (int i = 0; i < n; i++) {
+        file_io_t* io = &ios[order[i]];
+        if (direct_io && ((uintptr_t)io->page & (PAGE_SIZE - 1))) {
+            if (io->write)
+                file_write_page(io->table_id, io->page_num, io->page);
+            else
+                file_read_page(io->table_id, io->page_num, io->page);
+            continue;
+        }
+        iov[i].iov_base = io->page;
+        iov[i].iov_len = PAGE_SIZE;
+        if (!runs.empty()) {
+            file_run_t* run = &runs.back();
+            if (run->first + run->n == i && ios[order[i - 1]].table_id == io->table_id &&
+                run->page_num + run->n == io->page_num &&
+                run->write == io->write && run->n < FILE_IO_BATCH) {
+                run->n++;
+                continue;
+            }
+        }
+        runs.push_back({file_get_fd(io->table_id), io->page_num, io->write, i, 1});
+    }
+
+#ifdef USE_IO_URING
+    if (file_ring_submit(runs.data(), runs.size(), iov.data()) == 0)
+        return;
+#endif
+    for (file_run_t& run : runs) {
+        if (file_transfer(run.fd, run.page_num * PAGE_SIZE, &iov[run.first], run.n, run.write) != 0)
+            ERR_SYS("Failure to submit io(io error)");
+    }
+}
+
+/*
+ * Makes the pages written to a table, or to every open table with
+ * FILE_ALL_TABLES, durable. Page writes are not synced one by one: the log
+ * covers them until a checkpoint, which calls this before it is logged.
+ */
+void file_sync_table(int64_t table_id) {
+    int n = num_tables.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        if (table_id != FILE_ALL_TABLES && slots[i].table_id != table_id) continue;
+        if (fsync(slots[i].fd) != 0)
+            ERR_SYS("Failure to sync table(fsync error)");
+    }
+}
+
+// Sets whether tables opened from now on bypass the page cache.
+void file_set_direct_io(int direct) {
+    direct_io = direct;
 }
 
 void file_close_table_file() {
-    for (int i = 0; i < idx; i++) {
-        close(fds[i]);
-        fds[i] = 0;
+    pthread_mutex_lock(&tables_latch);
+    int n = num_tables.load(std::memory_order_relaxed);
+    num_tables.store(0, std::memory_order_release);
+    num_maps = 0;
+    for (int i = 0; i < n; i++) {
+        if (slots[i].map != NULL)
+            munmap(slots[i].map, slots[i].map_pages * PAGE_SIZE);
+        close(slots[i].fd);
+        slots[i].table_id.store(0, std::memory_order_relaxed);
+        slots[i].map = NULL;
     }
-    tables.clear();
-    idx = 0;
+    pthread_mutex_unlock(&tables_latch);
 }
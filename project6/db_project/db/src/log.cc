@@ -14,6 +14,7 @@ static char* logbuffer;
 static int log_tail;
 static uint64_t LSN;
 static uint64_t flushed_LSN;
+static uint64_t durable_LSN;      // end of the fsynced log
 static int log_fd;
 static pthread_mutex_t logbuffer_latch;
 
@@ -26,6 +27,7 @@ int init_log(char* log_path) {
     LSN = lseek(log_fd, 0, SEEK_END);
     printf("LSN : %ld\n", LSN);
     flushed_LSN = lseek(log_fd, 0, SEEK_END);
+    durable_LSN = flushed_LSN;
     log_tail = 0;
     if (LSN == 0) {
         log_write_log(0, 0, -1);
@@ -127,6 +129,25 @@ void log_force() {
         ERR_SYS("Failure to force log(write error)");
     fsync(log_fd);
     flushed_LSN = LSN;
+    durable_LSN = LSN;
     log_tail =  0;
     pthread_mutex_unlock(&logbuffer_latch);
 }
+
+/*
+ * Records below the returned LSN survive a crash. Unlike flushed_LSN this
+ * only moves in log_force, after the fsync.
+ */
+uint64_t log_get_durable_LSN() {
+    pthread_mutex_lock(&logbuffer_latch);
+    uint64_t ret_LSN = durable_LSN;
+    pthread_mutex_unlock(&logbuffer_latch);
+    return ret_LSN;
+}
+
+uint64_t log_get_LSN() {
+    pthread_mutex_lock(&logbuffer_latch);
+    uint64_t ret_LSN = LSN;
+    pthread_mutex_unlock(&logbuffer_latch);
+    return ret_LSN;
+}
@@ -1,6 +1,7 @@
 #include "recov.h"
 
 #include <algorithm>
+#include <map>
 #include <stdlib.h>
 #include <string.h>
 #include <vector>
@@ -8,6 +9,7 @@
 
 static std::set<int> winners;
 static std::set<int> losers;
+static uint64_t redo_LSN;
 
 void recovery(int flag, int log_num, char* logmsg_path) {
     int crash = 0;
@@ -23,6 +25,9 @@ void recovery(int flag, int log_num, char* logmsg_path) {
     fclose(fp);
 
     buffer_flush();
+    // nothing before the log end needs redo once a complete pass is written back
+    if (!crash)
+        buffer_checkpoint();
     file_close_table_file();
     log_force();
 }
@@ -32,14 +37,23 @@ void anls_pass(FILE* fp) {
     log_t* anls_log = (log_t*)malloc(300);
     uint64_t cur_LSN = 0;
     std::set<int> tables;
+    std::map<int, uint64_t> last_LSNs;
+    redo_LSN = 0;
     while (cur_LSN = log_read_log(cur_LSN, anls_log)) {
-        if (anls_log->table_id && tables.find(anls_log->table_id) == tables.end()) {
+        if (anls_log->type == CHECKPOINT) {
+            redo_LSN = anls_log->prev_LSN;
+            continue;
+        }
+        // only update and compensate records carry a table
+        if ((anls_log->type == UPDATE || anls_log->type == COMPENSATE) &&
+            tables.find(anls_log->table_id) == tables.end()) {
             char pathname[256];
             sprintf(pathname, "DATA%ld", anls_log->table_id);
             file_open_table_file(pathname);
             tables.insert(anls_log->table_id);
         }
         if (anls_log->trx_id > trx_get_trx_id()) trx_set_trx_id(anls_log->trx_id);
+        last_LSNs[anls_log->trx_id] = anls_log->LSN;
         if (anls_log->type == BEGIN) {
             losers.insert(anls_log->trx_id);
         } else if (anls_log->type == COMMIT || anls_log->type == ROLLBACK) {
@@ -50,6 +64,8 @@ void anls_pass(FILE* fp) {
     free(anls_log);
     for (const auto& loser : losers) {
         trx_resurrect_entry(loser);
+        // redo may start past the last records of a loser
+        trx_set_last_LSN(loser, last_LSNs[loser]);
     }
     fprintf(fp, "[ANALYSIS] Analysis pass end");
     fprintf(fp, ". Winner:");
@@ -65,9 +81,14 @@ int redo_pass(FILE* fp, int log_num) {
     fprintf(fp, "[REDO] Redo pass start.\n");
     log_t* redo_log = (log_t*)malloc(300);
     page_t* redo_page;
-    uint64_t cur_LSN = 0;
+    // changes logged before the last checkpoint's redo LSN are on disk
+    uint64_t cur_LSN = redo_LSN;
+    uint64_t ahead_LSN = redo_LSN;
     int count = log_num;
-    while (cur_LSN = log_read_log(cur_LSN, redo_log)) {
+    while (true) {
+        if (cur_LSN == ahead_LSN)
+            ahead_LSN = redo_prefetch(ahead_LSN);
+        if (!(cur_LSN = log_read_log(cur_LSN, redo_log))) break;
         if (count-- == 0) {
             free(redo_log);
             return 1;
@@ -77,8 +98,10 @@ int redo_pass(FILE* fp, int log_num) {
                 fprintf(fp, "LSN %lu [BEGIN] Transaction id %d\n", redo_log->LSN, redo_log->trx_id);
                 break;
             case UPDATE:
-                buffer_read_page(redo_log->table_id, redo_log->page_num, &redo_page);
+                buffer_read_page(redo_log->table_id, redo_log->page_num, &redo_page, SHARED);
                 if (redo_log->LSN > redo_page->page_LSN) {
+                    buffer_unpin_page(redo_log->table_id, redo_log->page_num);
+                    buffer_read_page(redo_log->table_id, redo_log->page_num, &redo_page);
                     memcpy((char*)redo_page + redo_log->offset, redo_log->trailer + redo_log->size, redo_log->size);
                     redo_page->page_LSN = redo_log->LSN;
                     buffer_write_page(redo_log->table_id, redo_log->page_num);
@@ -98,8 +121,10 @@ int redo_pass(FILE* fp, int log_num) {
                 fprintf(fp, "LSN %lu [ROLLBACK] Transaction id %d\n", redo_log->LSN, redo_log->trx_id);
                 break;
             case COMPENSATE:
-                buffer_read_page(redo_log->table_id, redo_log->page_num, &redo_page);
+                buffer_read_page(redo_log->table_id, redo_log->page_num, &redo_page, SHARED);
                 if (redo_log->LSN > redo_page->page_LSN) {
+                    buffer_unpin_page(redo_log->table_id, redo_log->page_num);
+                    buffer_read_page(redo_log->table_id, redo_log->page_num, &redo_page);
                     memcpy((char*)redo_page + redo_log->offset, redo_log->trailer + redo_log->size, redo_log->size);
                     redo_page->page_LSN = redo_log->LSN;
                     buffer_write_page(redo_log->table_id, redo_log->page_num);
@@ -120,6 +145,28 @@ int redo_pass(FILE* fp, int log_num) {
     return 0;
 }
 
+/*
+ * Starts reading the pages touched by the next REDO_PREFETCH_DEPTH log
+ * records from `ahead_LSN`, so redo does not wait on one page at a time.
+ * Returns the LSN following the last record looked at.
+ */
+uint64_t redo_prefetch(uint64_t ahead_LSN) {
+    log_t* ahead_log = (log_t*)malloc(300);
+    std::map<int64_t, std::vector<pagenum_t>> pages;
+    uint64_t next_LSN;
+    for (int i = 0; i < REDO_PREFETCH_DEPTH; i++) {
+        if (!(next_LSN = log_read_log(ahead_LSN, ahead_log))) break;
+        if (ahead_log->type == UPDATE || ahead_log->type == COMPENSATE)
+            pages[ahead_log->table_id].push_back(ahead_log->page_num);
+        ahead_LSN = next_LSN;
+    }
+    free(ahead_log);
+    for (auto& table : pages) {
+        buffer_prefetch_pages(table.first, table.second.data(), table.second.size());
+    }
+    return ahead_LSN;
+}
+
 int undo_pass(FILE* fp, int log_num) {
     fprintf(fp, "[UNDO] Undo pass start.\n");
     page_t* undo_page;
@@ -0,0 +1,437 @@
+#include "replace.h"
+
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+typedef std::pair<int64_t, pagenum_t> page_key_t;
+
+// Doubly linked lists of frame indices sharing one link array.
+struct frame_list_t {
+    int head;
+    int tail;
+    int size;
+};
+
+struct frame_links_t {
+    std::vector<int> prev;
+    std::vector<int> next;
+
+    void init(int num_frames) {
+        prev.assign(num_frames, -1);
+        next.assign(num_frames, -1);
+    }
+
+    void resize(int num_frames) {
+        prev.resize(num_frames, -1);
+        next.resize(num_frames, -1);
+    }
+
+    void push_back(frame_list_t* list, int idx) {
+        prev[idx] = list->tail;
+        next[idx] = -1;
+        if (list->tail != -1)
+            next[list->tail] = idx;
+        else
+            list->head = idx;
+        list->tail = idx;
+        list->size++;
+    }
+
+    void erase(frame_list_t* list, int idx) {
+        if (prev[idx] != -1)
+            next[prev[idx]] = next[idx];
+        else
+            list->head = next[idx];
+        if (next[idx] != -1)
+            prev[next[idx]] = prev[idx];
+        else
+            list->tail = prev[idx];
+        prev[idx] = -1;
+        next[idx] = -1;
+        list->size--;
+    }
+};
+
+static void frame_list_init(frame_list_t* list) {
+    list->head = -1;
+    list->tail = -1;
+    list->size = 0;
+}
+
+// LRU: one list, hits move the frame to the tail.
+
+struct lru_replacer_t : replacer_t {
+    frame_links_t links;
+    frame_list_t list;
+    std::vector<char> linked;
+
+    lru_replacer_t(int num_frames) {
+        links.init(num_frames);
+        frame_list_init(&list);
+        linked.assign(num_frames, 0);
+    }
+
+    void insert(int idx, int64_t, pagenum_t) override {
+        if (linked[idx]) links.erase(&list, idx);
+        links.push_back(&list, idx);
+        linked[idx] = 1;
+    }
+
+    void touch(int idx) override {
+        if (!linked[idx] || list.tail == idx) return;
+        links.erase(&list, idx);
+        links.push_back(&list, idx);
+    }
+
+    void remove(int idx) override {
+        if (!linked[idx]) return;
+        links.erase(&list, idx);
+        linked[idx] = 0;
+    }
+
+    int victim(int (*evictable)(void* arg, int idx), void* arg) override {
+        for (int idx = list.head; idx != -1; idx = links.next[idx]) {
+            if (evictable(arg, idx)) return idx;
+        }
+        return -1;
+    }
+
+    int candidates(int* dest, int n) override {
+        int count = 0;
+        for (int idx = list.head; idx != -1 && count < n; idx = links.next[idx])
+            dest[count++] = idx;
+        return count;
+    }
+
+    void resize(int num_frames) override {
+        links.resize(num_frames);
+        linked.resize(num_frames, 0);
+    }
+};
+
+// CLOCK: hits only set the reference bit, the hand clears it on its sweep.
+
+struct clock_replacer_t : replacer_t {
+    std::vector<char> ref;
+    std::vector<char> valid;
+    int hand;
+
+    clock_replacer_t(int num_frames) {
+        ref.assign(num_frames, 0);
+        valid.assign(num_frames, 0);
+        hand = 0;
+    }
+
+    void insert(int idx, int64_t, pagenum_t) override {
+        valid[idx] = 1;
+        ref[idx] = 1;
+    }
+
+    void touch(int idx) override {
+        if (!ref[idx]) ref[idx] = 1;
+    }
+
+    void remove(int idx) override {
+        valid[idx] = 0;
+        ref[idx] = 0;
+    }
+
+    int victim(int (*evictable)(void* arg, int idx), void* arg) override {
+        int num_frames = valid.size();
+        for (int i = 0; i < 2 * num_frames; i++) {
+            int idx = hand;
+            hand = (hand + 1) % num_frames;
+            if (!valid[idx]) continue;
+            if (ref[idx]) {
+                ref[idx] = 0;
+            } else if (evictable(arg, idx)) {
+                return idx;
+            }
+        }
+        return -1;
+    }
+
+    // frames the hand would take next, without clearing reference bits
+    int candidates(int* dest, int n) override {
+        int num_frames = valid.size();
+        int count = 0;
+        for (int i = 0, idx = hand; i < num_frames && count < n; i++) {
+            if (valid[idx] && !ref[idx]) dest[count++] = idx;
+            idx = (idx + 1) % num_frames;
+        }
+        return count;
+    }
+
+    void resize(int num_frames) override {
+        ref.resize(num_frames, 0);
+        valid.resize(num_frames, 0);
+        if (hand >= num_frames) hand = 0;
+    }
+};
+
+// 2Q: new pages enter the A1in FIFO and only reach the Am LRU list when they
+// are requested again after being evicted, while still remembered in A1out.
+
+#define NO_QUEUE    0
+#define A1IN_QUEUE  1
+#define AM_QUEUE    2
+
+struct two_q_replacer_t : replacer_t {
+    int kin;
+    int kout;
+    frame_links_t links;
+    frame_list_t a1in;
+    frame_list_t am;
+    std::vector<char> queue;
+    std::vector<page_key_t> keys;
+    std::list<page_key_t> a1out;
+    std::unordered_map<page_key_t, std::list<page_key_t>::iterator, pair_hash> a1out_map;
+
+    two_q_replacer_t(int num_frames) {
+        kin = TWO_Q_KIN(num_frames);
+        kout = TWO_Q_KOUT(num_frames);
+        links.init(num_frames);
+        frame_list_init(&a1in);
+        frame_list_init(&am);
+        queue.assign(num_frames, NO_QUEUE);
+        keys.resize(num_frames);
+    }
+
+    // Inserting a frame still queued evicts its page, which A1out remembers
+    // if it never left A1in.
+    void insert(int idx, int64_t table_id, pagenum_t page_num) override {
+        if (queue[idx] == A1IN_QUEUE)
+            remember(keys[idx]);
+        remove(idx);
+        keys[idx] = {table_id, page_num};
+        auto it = a1out_map.find(keys[idx]);
+        if (it != a1out_map.end()) {
+            a1out.erase(it->second);
+            a1out_map.erase(it);
+            links.push_back(&am, idx);
+            queue[idx] = AM_QUEUE;
+        } else {
+            links.push_back(&a1in, idx);
+            queue[idx] = A1IN_QUEUE;
+        }
+    }
+
+    void touch(int idx) override {
+        if (queue[idx] != AM_QUEUE || am.tail == idx) return;
+        links.erase(&am, idx);
+        links.push_back(&am, idx);
+    }
+
+    // A frame taken out while its page stays resident, kept through PRIORITY
+    // or moved to the sequential ring, is not remembered.
+    void remove(int idx) override {
+        if (queue[idx] == A1IN_QUEUE) {
+            links.erase(&a1in, idx);
+        } else if (queue[idx] == AM_QUEUE) {
+            links.erase(&am, idx);
+        }
+        queue[idx] = NO_QUEUE;
+    }
+
+    int victim(int (*evictable)(void* arg, int idx), void* arg) override {
+        frame_list_t* order[2] = {&am, &a1in};
+        if (a1in.size > kin || am.size == 0) {
+            order[0] = &a1in;
+            order[1] = &am;
+        }
+        for (int i = 0; i < 2; i++) {
+            for (int idx = order[i]->head; idx != -1; idx = links.next[idx]) {
+                if (evictable(arg, idx)) return idx;
+            }
+        }
+        return -1;
+    }
+
+    int candidates(int* dest, int n) override {
+        frame_list_t* order[2] = {&am, &a1in};
+        if (a1in.size > kin || am.size == 0) {
+            order[0] = &a1in;
+            order[1] = &am;
+        }
+        int count = 0;
+        for (int i = 0; i < 2; i++) {
+            for (int idx = order[i]->head; idx != -1 && count < n; idx = links.next[idx])
+                dest[count++] = idx;
+        }
+        return count;
+    }
+
+    void resize(int num_frames) override {
+        kin = TWO_Q_KIN(num_frames);
+        kout = TWO_Q_KOUT(num_frames);
+        links.resize(num_frames);
+        queue.resize(num_frames, NO_QUEUE);
+        keys.resize(num_frames);
+        while ((int)a1out.size() > kout) {
+            a1out_map.erase(a1out.front());
+            a1out.pop_front();
+        }
+    }
+
+    void remember(const page_key_t& key) {
+        auto it = a1out_map.find(key);
+        if (it != a1out_map.end()) a1out.erase(it->second);
+        a1out.push_back(key);
+        a1out_map[key] = std::prev(a1out.end());
+        if ((int)a1out.size() > kout) {
+            a1out_map.erase(a1out.front());
+            a1out.pop_front();
+        }
+    }
+};
+
+// LRU-K: evicts the frame whose K-th most recent reference is the oldest.
+// Frames with fewer than K references have an infinite backward distance and
+// go first, oldest first. The history of an evicted page is retained for a
+// while, LRU_K_RETAINED frames' worth, and picked up again if it is read
+// back, so pages referenced at intervals longer than their residency still
+// build up K references.
+
+#define NO_HISTORY      0
+#define YOUNG_HISTORY   1
+#define OLD_HISTORY     2
+
+struct lru_k_replacer_t : replacer_t {
+    uint64_t clock;
+    int max_retained;
+    std::vector<std::vector<uint64_t>> history;
+    std::vector<page_key_t> keys;
+    frame_links_t links;
+    frame_list_t young;
+    std::set<std::pair<uint64_t, int>> old;
+    std::vector<char> state;
+    // histories of evicted pages, oldest eviction first
+    std::list<std::pair<page_key_t, std::vector<uint64_t>>> retained;
+    std::unordered_map<page_key_t, decltype(retained)::iterator, pair_hash> retained_map;
+
+    lru_k_replacer_t(int num_frames) {
+        clock = 0;
+        max_retained = LRU_K_RETAINED(num_frames);
+        history.resize(num_frames);
+        keys.resize(num_frames);
+        links.init(num_frames);
+        frame_list_init(&young);
+        state.assign(num_frames, NO_HISTORY);
+    }
+
+    // Inserting a frame still placed evicts its page, whose history is kept.
+    void insert(int idx, int64_t table_id, pagenum_t page_num) override {
+        if (state[idx] != NO_HISTORY) {
+            unplace(idx);
+            retain(keys[idx], history[idx]);
+        }
+        keys[idx] = {table_id, page_num};
+        history[idx].clear();
+        auto it = retained_map.find(keys[idx]);
+        if (it != retained_map.end()) {
+            history[idx].swap(it->second->second);
+            retained.erase(it->second);
+            retained_map.erase(it);
+        }
+        history[idx].push_back(++clock);
+        if (history[idx].size() > LRU_K)
+            history[idx].erase(history[idx].begin());
+        place(idx);
+    }
+
+    void touch(int idx) override {
+        if (state[idx] == NO_HISTORY) return;
+        unplace(idx);
+        history[idx].push_back(++clock);
+        if (history[idx].size() > LRU_K)
+            history[idx].erase(history[idx].begin());
+        place(idx);
+    }
+
+    void remove(int idx) override {
+        if (state[idx] == NO_HISTORY) return;
+        unplace(idx);
+        history[idx].clear();
+    }
+
+    int victim(int (*evictable)(void* arg, int idx), void* arg) override {
+        for (int idx = young.head; idx != -1; idx = links.next[idx]) {
+            if (evictable(arg, idx)) return idx;
+        }
+        for (auto it = old.begin(); it != old.end(); ++it) {
+            int idx = it->second;
+            if (evictable(arg, idx)) return idx;
+        }
+        return -1;
+    }
+
+    int candidates(int* dest, int n) override {
+        int count = 0;
+        for (int idx = young.head; idx != -1 && count < n; idx = links.next[idx])
+            dest[count++] = idx;
+        for (auto it = old.begin(); it != old.end() && count < n; ++it)
+            dest[count++] = it->second;
+        return count;
+    }
+
+    void resize(int num_frames) override {
+        max_retained = LRU_K_RETAINED(num_frames);
+        history.resize(num_frames);
+        keys.resize(num_frames);
+        links.resize(num_frames);
+        state.resize(num_frames, NO_HISTORY);
+        while ((int)retained.size() > max_retained) {
+            retained_map.erase(retained.front().first);
+            retained.pop_front();
+        }
+    }
+
+    void retain(const page_key_t& key, std::vector<uint64_t>& refs) {
+        auto it = retained_map.find(key);
+        if (it != retained_map.end()) {
+            retained.erase(it->second);
+            retained_map.erase(it);
+        }
+        retained.push_back({key, std::vector<uint64_t>()});
+        retained.back().second.swap(refs);
+        retained_map[key] = std::prev(retained.end());
+        if ((int)retained.size() > max_retained) {
+            retained_map.erase(retained.front().first);
+            retained.pop_front();
+        }
+    }
+
+    void place(int idx) {
+        if (history[idx].size() < LRU_K) {
+            links.push_back(&young, idx);
+            state[idx] = YOUNG_HISTORY;
+        } else {
+            old.insert({history[idx].front(), idx});
+            state[idx] = OLD_HISTORY;
+        }
+    }
+
+    void unplace(int idx) {
+        if (state[idx] == YOUNG_HISTORY)
+            links.erase(&young, idx);
+        else if (state[idx] == OLD_HISTORY)
+            old.erase({history[idx].front(), idx});
+        state[idx] = NO_HISTORY;
+    }
+};
+
+replacer_t* replacer_create(int policy, int num_frames) {
+    switch (policy) {
+        case LRU_POLICY:
+            return new lru_replacer_t(num_frames);
+        case CLOCK_POLICY:
+            return new clock_replacer_t(num_frames);
+        case TWO_Q_POLICY:
+            return new two_q_replacer_t(num_frames);
+        case LRU_K_POLICY:
+            return new lru_k_replacer_t(num_frames);
+    }
+    return NULL;
+}
@@ -1,7 +1,8 @@
 #include "trx.h"
 
-#include <unordered_map>
+#include <stdlib.h>
 #include <string.h>
+#include <unordered_map>
 
 static pthread_mutex_t lock_latch;
 static pthread_mutex_t trx_latch;
@@ -236,11 +237,14 @@ int lock_acquire(int64_t table_id, pagenum_t page_num, int idx, int trx_id, int
                 pthread_mutex_unlock(&lock_latch);
                 return -1;
             }
+            // keep the page resident without blocking others during the wait
+            buffer_pin_page(table_id, page_num);
             buffer_unpin_page(table_id, page_num);
             pthread_cond_wait(&(cur_obj->cond_var), &lock_latch);
             trx_table[trx_id]->waits_for_trx_id = 0;
             pthread_mutex_unlock(&lock_latch);
-            buffer_read_page(table_id, page_num, p);
+            buffer_read_page(table_id, page_num, p, lock_mode);
+            buffer_drop_pin(table_id, page_num);
             pthread_mutex_lock(&lock_latch);
             cur_obj = lock_entry->head;
         } else {
@@ -0,0 +1,121 @@
+#include "buffer.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Page allocation through the bitmap pages, with a table large enough to
+ * span two bitmap groups.
+ */
+class AllocTest : public ::testing::Test {
+    protected:
+    const char* pathname = "DATA7001";
+    const char* log_path = "alloc_test_log.data";
+    int64_t table_id;
+
+    void open() {
+        ASSERT_EQ(init_log((char*)log_path), 0);
+        table_id = file_open_table_file(pathname);
+        ASSERT_GT(table_id, 0);
+        ASSERT_EQ(init_buffer(256), 0);
+    }
+
+    void close() {
+        shutdown_buffer();
+        file_close_table_file();
+        shutdown_log();
+    }
+
+    // Whether the bitmap page of `page_num` has its bit set.
+    int is_used(pagenum_t page_num) {
+        page_t* bitmap;
+        pagenum_t bitmap_num = file_bitmap_page(page_num);
+        buffer_read_page(table_id, bitmap_num, &bitmap, SHARED);
+        pagenum_t bit = page_num % FILE_BITMAP_BITS;
+        int used = (bitmap->bitmap[bit / 64] >> (bit % 64)) & 1;
+        buffer_unpin_page(table_id, bitmap_num);
+        return used;
+    }
+
+    pagenum_t num_pages() {
+        page_t* header;
+        buffer_read_page(table_id, 0, &header, SHARED);
+        pagenum_t num_pages = header->num_pages;
+        buffer_unpin_page(table_id, 0);
+        return num_pages;
+    }
+
+    AllocTest() {
+        unlink(pathname);
+        unlink(log_path);
+    }
+
+    ~AllocTest() {
+        unlink(pathname);
+        unlink(log_path);
+    }
+};
+
+/*
+ * A run filling the first group leaves the header and the bitmap page out,
+ * the next pages come from the second group around its bitmap page, and
+ * freed pages are found again near where they were.
+ */
+TEST_F(AllocTest, CrossesBitmapGroups) {
+    open();
+    EXPECT_EQ(num_pages(), (pagenum_t)INITIAL_PAGENUM);
+
+    pagenum_t run = buffer_alloc_pages(table_id, 0, FILE_BITMAP_BITS - 2);
+    EXPECT_EQ(run, 2);
+    EXPECT_GE(num_pages(), (pagenum_t)FILE_BITMAP_BITS);
+    EXPECT_TRUE(is_used(2));
+    EXPECT_TRUE(is_used(FILE_BITMAP_BITS - 1));
+
+    pagenum_t first = buffer_alloc_page(table_id);
+    pagenum_t second = buffer_alloc_page(table_id);
+    EXPECT_EQ(first, (pagenum_t)FILE_BITMAP_BITS);
+    EXPECT_EQ(second, (pagenum_t)FILE_BITMAP_BITS + 2);
+    EXPECT_EQ(file_bitmap_page(second), (pagenum_t)FILE_BITMAP_BITS + 1);
+
+    buffer_free_page(table_id, 100);
+    buffer_free_page(table_id, first);
+    EXPECT_FALSE(is_used(100));
+    EXPECT_FALSE(is_used(first));
+    EXPECT_EQ(buffer_alloc_page(table_id, first), first);
+    EXPECT_EQ(buffer_alloc_page(table_id, 50), 100);
+    close();
+}
+
+// The bitmap pages are written back and read again on reopen.
+TEST_F(AllocTest, KeepsBitmapsAcrossReopen) {
+    open();
+    pagenum_t run = buffer_alloc_pages(table_id, 0, FILE_BITMAP_BITS - 2);
+    pagenum_t page_num = buffer_alloc_page(table_id);
+    buffer_free_page(table_id, run + 10);
+    close();
+
+    open();
+    EXPECT_TRUE(is_used(run));
+    EXPECT_FALSE(is_used(run + 10));
+    EXPECT_TRUE(is_used(page_num));
+    EXPECT_EQ(buffer_alloc_page(table_id), run + 10);
+    EXPECT_EQ(buffer_alloc_page(table_id, page_num), page_num + 2);
+    close();
+}
+
+// A table file from before bitmap pages is refused without exiting.
+TEST_F(AllocTest, RefusesOldFormat) {
+    int fd = ::open(pathname, O_RDWR | O_CREAT, 0644);
+    page_t header;
+    memset(&header, 0, PAGE_SIZE);
+    header.next_frpg = INITIAL_PAGENUM - 1;
+    header.num_pages = INITIAL_PAGENUM;
+    ASSERT_EQ(pwrite(fd, &header, PAGE_SIZE, 0), PAGE_SIZE);
+    ::close(fd);
+
+    EXPECT_EQ(file_open_table_file(pathname), -1);
+    EXPECT_EQ(file_map_table_file(pathname), -1);
+    file_close_table_file();
+}
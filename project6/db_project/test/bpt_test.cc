@@ -0,0 +1,101 @@
+#include "bpt.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * A table opened read-only, whose pages are mapped instead of read through
+ * the buffer.
+ */
+class MappedTableTest : public ::testing::Test {
+    protected:
+    const char* pathname = "DATA7007";
+    const char* log_path = "bpt_test_log.data";
+    const char* logmsg_path = "bpt_test_msg.txt";
+    static const int num_keys = 5000;
+
+    int init() {
+        return init_db(64, 0, 0, (char*)log_path, (char*)logmsg_path, LRU_POLICY,
+                       BUFFER_PARTS, 0, 0, NULL);
+    }
+
+    // Writes the table through the buffer, each value starting with its key.
+    void load() {
+        ASSERT_EQ(init(), 0);
+        int64_t table_id = open_table((char*)pathname);
+        ASSERT_GT(table_id, 0);
+        char value[50];
+        memset(value, 'a', sizeof(value));
+        for (int64_t key = 0; key < num_keys; key++) {
+            memcpy(value, &key, sizeof(key));
+            ASSERT_EQ(db_insert(table_id, key, value, sizeof(value)), 0);
+        }
+        ASSERT_EQ(shutdown_db(), 0);
+    }
+
+    // Number of keys not found with their value.
+    int count_bad(int64_t table_id) {
+        int trx_id = trx_begin();
+        int bad = 0;
+        for (int64_t key = 0; key < num_keys; key++) {
+            char value[128];
+            uint16_t size;
+            if (db_find(table_id, key, value, &size, trx_id) != 0 || size != 50 ||
+                memcmp(value, &key, sizeof(key)) != 0)
+                bad++;
+        }
+        trx_commit(trx_id);
+        return bad;
+    }
+
+    static int count_visit(int64_t, char*, uint16_t, void*) {
+        return 0;
+    }
+
+    MappedTableTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(logmsg_path);
+    }
+
+    ~MappedTableTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(logmsg_path);
+    }
+};
+
+/*
+ * Lookups and scans are served from the mapping, leaving the buffer
+ * untouched, and every change is refused.
+ */
+TEST_F(MappedTableTest, ServesReadsAndRefusesChanges) {
+    load();
+    ASSERT_EQ(init(), 0);
+    int64_t table_id = open_table((char*)pathname, 1);
+    ASSERT_GT(table_id, 0);
+    page_t* header = file_map_page(table_id, 0);
+    ASSERT_NE(header, nullptr);
+    ASSERT_NE(header->root_num, 0UL);
+
+    buffer_stats_t before, after;
+    buffer_get_stats(BUFFER_ALL_TABLES, &before);
+    EXPECT_EQ(count_bad(table_id), 0);
+    EXPECT_EQ(db_scan(table_id, 100, count_visit, NULL), num_keys - 100);
+    buffer_get_stats(BUFFER_ALL_TABLES, &after);
+    EXPECT_EQ(after.hits, before.hits);
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_EQ(buffer_get_buffer_idx(table_id, header->root_num), -1);
+
+    char value[50];
+    memset(value, 'b', sizeof(value));
+    uint16_t old_size;
+    EXPECT_EQ(db_insert(table_id, num_keys, value, sizeof(value)), -1);
+    EXPECT_EQ(db_delete(table_id, 0), -1);
+    int trx_id = trx_begin();
+    EXPECT_EQ(db_update(table_id, 1, value, sizeof(value), &old_size, trx_id), -1);
+    trx_commit(trx_id);
+    EXPECT_EQ(count_bad(table_id), 0);
+    shutdown_db();
+}
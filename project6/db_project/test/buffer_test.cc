@@ -0,0 +1,363 @@
+#include "buffer.h"
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
+/*
+ * Buffer pool tests on a run of pages each holding its own page number and a
+ * counter of the writes it got.
+ */
+class BufferTest : public ::testing::Test {
+    protected:
+    const char* pathname = "DATA7003";
+    const char* log_path = "buffer_test_log.data";
+    const char* resident_path = "buffer_test_resident.data";
+    int64_t table_id;
+    pagenum_t first;
+    int num_pages;
+
+    void open(int num_buf, int num_part) {
+        ASSERT_EQ(init_log((char*)log_path), 0);
+        table_id = file_open_table_file(pathname);
+        ASSERT_GT(table_id, 0);
+        ASSERT_EQ(init_buffer(num_buf, LRU_POLICY, num_part), 0);
+    }
+
+    void close() {
+        shutdown_buffer();
+        file_close_table_file();
+        shutdown_log();
+    }
+
+    // Allocates and stamps `n` pages, then opens an empty buffer on them.
+    void load(int n, int num_buf, int num_part) {
+        open(256, 1);
+        num_pages = n;
+        first = buffer_alloc_pages(table_id, 0, n);
+        for (int i = 0; i < n; i++) {
+            page_t* p;
+            buffer_read_page(table_id, first + i, &p);
+            pagenum_t page_num = first + i;
+            uint64_t writes = 0;
+            memcpy(p->values, &page_num, sizeof(page_num));
+            memcpy(p->values + 8, &writes, sizeof(writes));
+            buffer_write_page(table_id, first + i);
+        }
+        close();
+        open(num_buf, num_part);
+    }
+
+    // Whether page `i` of the run holds its stamp, adding its writes to `*writes`.
+    int check(int i, uint64_t* writes = NULL) {
+        page_t* p;
+        pagenum_t page_num;
+        buffer_read_page(table_id, first + i, &p, SHARED);
+        memcpy(&page_num, p->values, sizeof(page_num));
+        if (writes != NULL) {
+            uint64_t n;
+            memcpy(&n, p->values + 8, sizeof(n));
+            *writes += n;
+        }
+        buffer_unpin_page(table_id, first + i);
+        return page_num == first + i;
+    }
+
+    void write(int i) {
+        page_t* p;
+        uint64_t writes;
+        buffer_read_page(table_id, first + i, &p);
+        memcpy(&writes, p->values + 8, sizeof(writes));
+        writes++;
+        memcpy(p->values + 8, &writes, sizeof(writes));
+        buffer_write_page(table_id, first + i);
+    }
+
+    // Reads page `i` and releases it with PRIORITY.
+    void keep(int i) {
+        page_t* p;
+        buffer_read_page(table_id, first + i, &p, SHARED);
+        buffer_unpin_page(table_id, first + i, PRIORITY);
+    }
+
+    int is_resident(int i) {
+        return buffer_get_buffer_idx(table_id, first + i) != -1;
+    }
+
+    BufferTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(resident_path);
+    }
+
+    ~BufferTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(resident_path);
+    }
+};
+
+/*
+ * Grows and shrinks the buffer down to its smallest size while readers and
+ * writers go over a run of pages larger than it, then checks every page and
+ * that no write was lost to a frame cut away.
+ */
+class ResizeTest : public BufferTest {
+    protected:
+    struct load_arg_t {
+        ResizeTest* test;
+        std::atomic<int>* running;
+        unsigned seed;
+        uint64_t writes;
+        int bad;
+    };
+
+    static void* worker(void* arg) {
+        load_arg_t* load = (load_arg_t*)arg;
+        while (*(load->running)) {
+            int i = rand_r(&(load->seed)) % load->test->num_pages;
+            if (i % 4 == 0) {
+                load->test->write(i);
+                load->writes++;
+            } else if (!load->test->check(i)) {
+                load->bad++;
+            }
+        }
+        return NULL;
+    }
+};
+
+TEST_F(ResizeTest, GrowsAndShrinksUnderLoad) {
+    load(2000, 512, 4);
+    std::atomic<int> running(1);
+    pthread_t threads[4];
+    load_arg_t loads[4];
+    for (int i = 0; i < 4; i++) {
+        loads[i] = {this, &running, (unsigned)i + 1, 0, 0};
+        ASSERT_EQ(pthread_create(&threads[i], 0, worker, &loads[i]), 0);
+    }
+    int sizes[] = {1024, 64, 3000, 100, 512};
+    for (int num_buf : sizes) {
+        usleep(20000);
+        EXPECT_EQ(buffer_resize(num_buf), 0);
+    }
+    EXPECT_EQ(buffer_resize(63), -1);
+    usleep(20000);
+    running = 0;
+
+    uint64_t writes = 0;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(loads[i].bad, 0);
+        writes += loads[i].writes;
+    }
+    EXPECT_GT(writes, 0UL);
+    close();
+
+    open(128, 1);
+    uint64_t found = 0;
+    int bad = 0;
+    for (int i = 0; i < num_pages; i++)
+        bad += !check(i, &found);
+    EXPECT_EQ(bad, 0);
+    EXPECT_EQ(found, writes);
+    close();
+}
+
+struct resize_arg_t {
+    int num_buf;
+    std::atomic<int> done;
+    int ret;
+};
+
+static void* resize_worker(void* arg) {
+    resize_arg_t* resize = (resize_arg_t*)arg;
+    resize->ret = buffer_resize(resize->num_buf);
+    resize->done = 1;
+    return NULL;
+}
+
+/*
+ * Frames handed out last are the first cut by a shrink, which waits for their
+ * pins to drop; meanwhile their pages stay in place and can still be written.
+ */
+TEST_F(BufferTest, PinnedFramesSurviveShrink) {
+    load(300, 256, 1);
+    for (int i = 0; i < 256; i++)
+        check(i);
+    page_t* pinned[8];
+    for (int i = 0; i < 8; i++) {
+        buffer_read_page(table_id, first + 248 + i, &pinned[i]);
+    }
+
+    resize_arg_t resize;
+    resize.num_buf = 32;
+    resize.done = 0;
+    pthread_t thread;
+    ASSERT_EQ(pthread_create(&thread, 0, resize_worker, &resize), 0);
+    usleep(100000);
+    EXPECT_FALSE(resize.done);
+    for (int i = 0; i < 8; i++) {
+        pagenum_t page_num;
+        memcpy(&page_num, pinned[i]->values, sizeof(page_num));
+        EXPECT_EQ(page_num, first + 248 + i);
+        uint64_t writes = 100 + i;
+        memcpy(pinned[i]->values + 8, &writes, sizeof(writes));
+        buffer_write_page(table_id, first + 248 + i);
+    }
+    pthread_join(thread, NULL);
+    EXPECT_EQ(resize.ret, 0);
+
+    for (int i = 0; i < 8; i++) {
+        uint64_t writes = 0;
+        EXPECT_TRUE(check(248 + i, &writes));
+        EXPECT_EQ(writes, 100UL + i);
+    }
+    close();
+}
+
+/*
+ * Pages released with PRIORITY stay resident through a pass over many others,
+ * up to the budget; lowering the budget hands the rest back to the replacer.
+ */
+TEST_F(BufferTest, KeepsPriorityPagesWithinBudget) {
+    load(1000, 128, 1);
+    buffer_set_priority_budget(4);
+    for (int i = 0; i < 6; i++)
+        keep(i);
+    for (int i = 100; i < 1000; i++)
+        check(i);
+    int kept = 0;
+    for (int i = 0; i < 6; i++)
+        kept += is_resident(i);
+    EXPECT_EQ(kept, 4);
+
+    buffer_set_priority_budget(2);
+    for (int i = 100; i < 1000; i++)
+        check(i);
+    kept = 0;
+    for (int i = 0; i < 6; i++)
+        kept += is_resident(i);
+    EXPECT_EQ(kept, 2);
+    close();
+}
+
+/*
+ * With the budget full, a new root gets in by taking the place of the kept
+ * page not used since the others were, and stays there while they are used.
+ */
+TEST_F(BufferTest, NewRootDemotesColdestPriorityPage) {
+    load(1000, 128, 1);
+    buffer_set_priority_budget(4);
+    for (int i = 0; i < 4; i++)
+        keep(i);
+    for (int i = 1; i < 4; i++)
+        keep(i);
+    keep(10);
+    for (int i = 100; i < 1000; i++) {
+        check(i);
+        if (i % 100 == 0) {
+            for (int j = 1; j < 4; j++)
+                keep(j);
+            keep(10);
+        }
+    }
+    EXPECT_FALSE(is_resident(0));
+    for (int i = 1; i < 4; i++)
+        EXPECT_TRUE(is_resident(i)) << i;
+    EXPECT_TRUE(is_resident(10));
+    close();
+}
+
+/*
+ * A SEQUENTIAL pass reads through the ring of recycled frames, leaving the
+ * pages read before it resident, where a regular pass pushes them out.
+ */
+TEST_F(BufferTest, SequentialReadsStayInRing) {
+    load(1000, 128, 1);
+    for (int i = 0; i < 64; i++)
+        check(i);
+    buffer_stats_t before, after;
+    buffer_get_stats(BUFFER_ALL_TABLES, &before);
+    for (int i = 100; i < 1000; i++) {
+        page_t* p;
+        buffer_read_page(table_id, first + i, &p, SHARED | SEQUENTIAL);
+        buffer_unpin_page(table_id, first + i);
+    }
+    buffer_get_stats(BUFFER_ALL_TABLES, &after);
+    for (int i = 0; i < 64; i++)
+        EXPECT_TRUE(is_resident(i)) << i;
+    EXPECT_EQ(after.misses - before.misses, 900UL);
+
+    for (int i = 100; i < 1000; i++)
+        check(i);
+    int resident = 0;
+    for (int i = 0; i < 64; i++)
+        resident += is_resident(i);
+    EXPECT_EQ(resident, 0);
+    close();
+}
+
+/*
+ * Prefetching skips pages resident or already pending, and a page read while
+ * its prefetch is pending is served only once the read completes, never from
+ * what the frame held before.
+ */
+TEST_F(BufferTest, PrefetchSkipsResidentAndPendingPages) {
+    load(1000, 256, 1);
+    for (int i = 0; i < 256; i++)
+        check(i);
+    pagenum_t page_nums[80];
+    for (int i = 0; i < 8; i++)
+        page_nums[i] = first + i;
+    EXPECT_EQ(buffer_prefetch_pages(table_id, page_nums, 8), 0);
+
+    // each page twice: the second finds the first not queued yet
+    for (int i = 0; i < 80; i++)
+        page_nums[i] = first + 300 + i / 2;
+    buffer_stats_t before, after;
+    buffer_get_stats(BUFFER_ALL_TABLES, &before);
+    EXPECT_EQ(buffer_prefetch_pages(table_id, page_nums, 80), 40);
+    for (int i = 0; i < 40; i++)
+        EXPECT_TRUE(check(300 + i)) << i;
+    buffer_get_stats(BUFFER_ALL_TABLES, &after);
+    EXPECT_EQ(after.prefetches - before.prefetches, 40UL);
+    EXPECT_EQ(after.misses - before.misses, 40UL);
+    EXPECT_EQ(after.hits - before.hits, 40UL);
+    EXPECT_EQ(buffer_prefetch_pages(table_id, page_nums, 80), 0);
+    close();
+}
+
+// Pages saved as resident are read back in when their table is warmed.
+TEST_F(BufferTest, WarmsTableFromSavedResidentPages) {
+    load(300, 256, 1);
+    for (int i = 100; i < 200; i++)
+        check(i);
+    int saved = buffer_save_resident(resident_path);
+    EXPECT_GE(saved, 100);
+    close();
+
+    open(256, 1);
+    EXPECT_EQ(buffer_load_resident(resident_path), saved);
+    buffer_warm_table(table_id);
+    int resident = 0;
+    for (int tries = 0; tries < 200 && resident < 100; tries++) {
+        usleep(10000);
+        resident = 0;
+        for (int i = 100; i < 200; i++)
+            resident += is_resident(i);
+    }
+    EXPECT_EQ(resident, 100);
+
+    buffer_stats_t before, after;
+    buffer_get_stats(BUFFER_ALL_TABLES, &before);
+    for (int i = 100; i < 200; i++)
+        EXPECT_TRUE(check(i)) << i;
+    buffer_get_stats(BUFFER_ALL_TABLES, &after);
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_FALSE(is_resident(0));
+    close();
+}
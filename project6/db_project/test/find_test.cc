@@ -0,0 +1,244 @@
+#include "bpt.h"
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
+/*
+ * Descents of a tree of three levels, optimistic or latched, while its inner
+ * pages change or leave the buffer.
+ */
+class FindTest : public ::testing::Test {
+    protected:
+    const char* pathname = "DATA7005";
+    const char* log_path = "find_test_log.data";
+    const char* logmsg_path = "find_test_msg.txt";
+    static const int num_keys = 20000;
+    int64_t table_id;
+
+    struct find_arg_t {
+        int64_t table_id;
+        int64_t key;
+        pagenum_t leaf_pgnum;
+        std::atomic<int> done;
+    };
+
+    static void* finder(void* arg) {
+        find_arg_t* find = (find_arg_t*)arg;
+        find->leaf_pgnum = find_leaf(find->table_id, find->key);
+        find->done = 1;
+        return NULL;
+    }
+
+    void load(int num_buf, int swizzle = 0) {
+        ASSERT_EQ(init_db(num_buf, 0, 0, (char*)log_path, (char*)logmsg_path, LRU_POLICY,
+                          BUFFER_PARTS, swizzle, 0, NULL), 0);
+        table_id = open_table((char*)pathname);
+        ASSERT_GT(table_id, 0);
+        char value[100];
+        memset(value, 'a', sizeof(value));
+        for (int key = 0; key < num_keys; key++)
+            ASSERT_EQ(db_insert(table_id, key, value, sizeof(value)), 0);
+    }
+
+    pagenum_t root() {
+        page_t* header;
+        buffer_read_page(table_id, 0, &header, SHARED);
+        pagenum_t root_num = header->root_num;
+        buffer_unpin_page(table_id, 0);
+        return root_num;
+    }
+
+    // Whether `leaf_pgnum` is a leaf holding `key`.
+    int holds(pagenum_t leaf_pgnum, int64_t key) {
+        page_t* p;
+        int found = 0;
+        buffer_read_page(table_id, leaf_pgnum, &p, SHARED);
+        for (uint32_t i = 0; p->is_leaf && i < p->num_keys; i++)
+            found |= p->slots[i].key == key;
+        buffer_unpin_page(table_id, leaf_pgnum);
+        return found;
+    }
+
+    // Swips followed by a descent to `key`, which must find it.
+    uint64_t descend(int64_t key) {
+        buffer_stats_t before, after;
+        buffer_get_stats(BUFFER_ALL_TABLES, &before);
+        EXPECT_TRUE(holds(find_leaf(table_id, key), key)) << key;
+        buffer_get_stats(BUFFER_ALL_TABLES, &after);
+        return after.swip_hits - before.swip_hits;
+    }
+
+    // Reads every page but the header and `skip`, pushing the others out.
+    void read_all(pagenum_t skip) {
+        page_t *header, *p;
+        buffer_read_page(table_id, 0, &header, SHARED);
+        pagenum_t num_pages = header->num_pages;
+        buffer_unpin_page(table_id, 0);
+        for (pagenum_t page_num = 1; page_num < num_pages; page_num++) {
+            if (page_num == skip) continue;
+            buffer_read_page(table_id, page_num, &p, SHARED);
+            buffer_unpin_page(table_id, page_num);
+        }
+    }
+
+    // Child of the root on the path to key 0, or to the last key.
+    pagenum_t root_child(int last = 0) {
+        page_t* p;
+        pagenum_t root_num = root();
+        buffer_read_page(table_id, root_num, &p, SHARED);
+        EXPECT_FALSE(p->is_leaf);
+        pagenum_t child = last ? p->entries[p->num_keys - 1].child : p->left_child;
+        buffer_unpin_page(table_id, root_num);
+        return child;
+    }
+
+    // Keeps a page through PRIORITY, after handing back all those kept.
+    void keep_only(pagenum_t page_num) {
+        page_t* p;
+        buffer_set_priority_budget(0);
+        buffer_set_priority_budget(-1);
+        buffer_read_page(table_id, page_num, &p, SHARED);
+        buffer_unpin_page(table_id, page_num, PRIORITY);
+    }
+
+    FindTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(logmsg_path);
+    }
+
+    ~FindTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(logmsg_path);
+    }
+};
+
+/*
+ * A change of the root between a peek and its validation fails the
+ * validation, and a descent meeting the root being changed retries, then
+ * waits on its latch, finding the same leaf once it is released.
+ */
+TEST_F(FindTest, RetriesWhenInnerPageChanges) {
+    load(256);
+    pagenum_t root_num = root();
+    pagenum_t leaf_pgnum = find_leaf(table_id, 1234);
+    ASSERT_TRUE(holds(leaf_pgnum, 1234));
+
+    page_t *peeked, *latched;
+    uint64_t version;
+    ASSERT_EQ(buffer_peek_page(table_id, root_num, &peeked, &version), 0);
+    EXPECT_TRUE(buffer_validate(peeked, version));
+    buffer_read_page(table_id, root_num, &latched, EXCLUSIVE);
+    EXPECT_FALSE(buffer_validate(peeked, version));
+    pagenum_t found;
+    EXPECT_EQ(find_leaf_optimistic(table_id, 1234, &found), 1);
+
+    find_arg_t find;
+    find.table_id = table_id;
+    find.key = 1234;
+    find.done = 0;
+    pthread_t thread;
+    ASSERT_EQ(pthread_create(&thread, 0, finder, &find), 0);
+    usleep(50000);
+    EXPECT_FALSE(find.done);
+    buffer_write_page(table_id, root_num);
+    pthread_join(thread, NULL);
+    EXPECT_EQ(find.leaf_pgnum, leaf_pgnum);
+
+    // header, root, inner page and leaf, each counted as a hit
+    buffer_stats_t before, after;
+    buffer_get_stats(BUFFER_ALL_TABLES, &before);
+    EXPECT_FALSE(buffer_validate(peeked, version));
+    EXPECT_EQ(find_leaf_optimistic(table_id, 1234, &found), 0);
+    EXPECT_EQ(found, leaf_pgnum);
+    buffer_get_stats(BUFFER_ALL_TABLES, &after);
+    EXPECT_EQ(after.hits - before.hits, 4UL);
+    shutdown_db();
+}
+
+/*
+ * An inner page below the root pushed out of the buffer stops optimistic
+ * descents, which go on latched from it; every key is still found.
+ */
+TEST_F(FindTest, FindsEveryKeyAfterInnerPageEviction) {
+    load(64);
+    pagenum_t root_num = root();
+    pagenum_t mid_pgnum = root_child();
+    page_t* p;
+    buffer_read_page(table_id, mid_pgnum, &p, SHARED);
+    ASSERT_FALSE(p->is_leaf);
+    buffer_unpin_page(table_id, mid_pgnum);
+
+    buffer_set_priority_budget(0);
+    read_all(mid_pgnum);
+    // the descent starts from pages read back in
+    EXPECT_EQ(root(), root_num);
+    buffer_read_page(table_id, root_num, &p, SHARED);
+    buffer_unpin_page(table_id, root_num);
+    ASSERT_EQ(buffer_get_buffer_idx(table_id, mid_pgnum), -1);
+    pagenum_t found;
+    EXPECT_EQ(find_leaf_optimistic(table_id, 0, &found), -1);
+    EXPECT_EQ(found, mid_pgnum);
+
+    int bad = 0;
+    for (int key = 0; key < num_keys; key++)
+        bad += !holds(find_leaf(table_id, key), key);
+    EXPECT_EQ(bad, 0);
+    shutdown_db();
+}
+
+/*
+ * With swizzling, a descent follows the swip from the root to the inner page
+ * below it only if that page is kept through PRIORITY, and none to the leaf.
+ * Latching the root EXCLUSIVE clears its swips, set again by the next
+ * descent and followed by the one after.
+ */
+TEST_F(FindTest, SwizzlesKeptChildrenOnly) {
+    load(256, 1);
+    keep_only(root_child());
+    descend(0);
+    EXPECT_EQ(descend(0), 1UL);
+    descend(num_keys - 1);
+    EXPECT_EQ(descend(num_keys - 1), 0UL);
+
+    pagenum_t root_num = root();
+    page_t* p;
+    buffer_read_page(table_id, root_num, &p, EXCLUSIVE);
+    buffer_write_page(table_id, root_num);
+    EXPECT_EQ(descend(0), 0UL);
+    EXPECT_EQ(descend(0), 1UL);
+    shutdown_db();
+}
+
+/*
+ * A swizzled inner page handed back to the replacer by a smaller budget
+ * loses its swip. Once evicted, a descent reads it back from its parent and
+ * keeps it again, and the next ones swizzle it and follow the swip.
+ */
+TEST_F(FindTest, ReswizzlesAfterChildEviction) {
+    load(64, 1);
+    pagenum_t mid_pgnum = root_child();
+    keep_only(mid_pgnum);
+    descend(0);
+    ASSERT_EQ(descend(0), 1UL);
+
+    buffer_set_priority_budget(0);
+    EXPECT_EQ(descend(0), 0UL);
+    read_all(root());
+    ASSERT_EQ(buffer_get_buffer_idx(table_id, mid_pgnum), -1);
+
+    buffer_set_priority_budget(-1);
+    EXPECT_EQ(descend(0), 0UL);
+    EXPECT_EQ(descend(0), 0UL);
+    EXPECT_EQ(descend(0), 1UL);
+    int bad = 0;
+    for (int key = 0; key < num_keys; key++)
+        bad += !holds(find_leaf(table_id, key), key);
+    EXPECT_EQ(bad, 0);
+    shutdown_db();
+}
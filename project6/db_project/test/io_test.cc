@@ -0,0 +1,160 @@
+#include "file.h"
+
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#ifdef USE_IO_URING
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Batches of page reads and writes given to file_submit_io(), moved through
+ * io_uring when built with USE_IO_URING and with preadv/pwritev otherwise.
+ */
+class IoTest : public ::testing::Test {
+    protected:
+    const char* pathname = "DATA7006";
+    static const int num_pages = 200;
+    int64_t table_id;
+
+    struct batch_arg_t {
+        IoTest* test;
+        int rings;      // rings opened by the thread while it ran
+        int bad;
+    };
+
+    // Writes every page stamped with its number, then reads them back out of order.
+    int round_trip() {
+        std::vector<page_t> pages(num_pages);
+        std::vector<file_io_t> ios(num_pages);
+        for (int i = 0; i < num_pages; i++) {
+            pagenum_t page_num = i + 1;
+            memset(&pages[i], 0, sizeof(page_t));
+            memcpy(pages[i].values, &page_num, sizeof(page_num));
+            ios[i] = {table_id, page_num, &pages[i], 1};
+        }
+        file_submit_io(ios.data(), num_pages);
+
+        // odd pages in descending order, then even ones, in runs cut by gaps
+        for (int i = 0; i < num_pages; i++) {
+            pagenum_t page_num = i < num_pages / 2 ? num_pages - 2 * i : 2 * (i - num_pages / 2) + 1;
+            memset(&pages[i], 0, sizeof(page_t));
+            ios[i] = {table_id, page_num, &pages[i], 0};
+        }
+        file_submit_io(ios.data(), num_pages);
+        int bad = 0;
+        for (int i = 0; i < num_pages; i++) {
+            pagenum_t page_num;
+            memcpy(&page_num, pages[i].values, sizeof(page_num));
+            bad += page_num != ios[i].page_num;
+        }
+        return bad;
+    }
+
+    // Open io_uring instances of the process.
+    static int count_rings() {
+        DIR* dir = opendir("/proc/self/fd");
+        int n = 0;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char path[300], target[64];
+            snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+            ssize_t len = readlink(path, target, sizeof(target) - 1);
+            if (len < 0) continue;
+            target[len] = '\0';
+            n += strcmp(target, "anon_inode:[io_uring]") == 0;
+        }
+        closedir(dir);
+        return n;
+    }
+
+    // Does a round trip on a thread of its own, which starts without a ring.
+    static void* batch_worker(void* arg) {
+        batch_arg_t* batch = (batch_arg_t*)arg;
+        int before = count_rings();
+        batch->bad = batch->test->round_trip();
+        batch->rings = count_rings() - before;
+        return NULL;
+    }
+
+    batch_arg_t run_batch() {
+        batch_arg_t batch = {this, 0, 0};
+        pthread_t thread;
+        if (pthread_create(&thread, 0, batch_worker, &batch) != 0)
+            batch.bad = -1;
+        else
+            pthread_join(thread, NULL);
+        return batch;
+    }
+
+    IoTest() {
+        unlink(pathname);
+        table_id = file_open_table_file(pathname);
+    }
+
+    ~IoTest() {
+        file_close_table_file();
+        unlink(pathname);
+    }
+};
+
+TEST_F(IoTest, MovesBatchesOfPages) {
+    ASSERT_GT(table_id, 0);
+    EXPECT_EQ(round_trip(), 0);
+}
+
+#ifdef USE_IO_URING
+/*
+ * A thread sets up a ring of its own on its first batch and closes it when it
+ * exits. Skipped where the kernel refuses io_uring.
+ */
+TEST_F(IoTest, MovesBatchesThroughRingOfThread) {
+    ASSERT_GT(table_id, 0);
+    int before = count_rings();
+    batch_arg_t batch = run_batch();
+    if (batch.bad == 0 && batch.rings == 0)
+        GTEST_SKIP() << "io_uring not available";
+    EXPECT_EQ(batch.bad, 0);
+    EXPECT_EQ(batch.rings, 1);
+    EXPECT_EQ(count_rings(), before);
+}
+
+/*
+ * A process whose seccomp policy refuses io_uring_setup still moves its
+ * batches, through the synchronous calls.
+ */
+TEST_F(IoTest, FallsBackWithoutRing) {
+    ASSERT_GT(table_id, 0);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        struct sock_filter filter[] = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_io_uring_setup, 0, 1),
+            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EPERM),
+            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+        };
+        struct sock_fprog prog = {sizeof(filter) / sizeof(filter[0]), filter};
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0 ||
+            prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) != 0)
+            _exit(2);
+        batch_arg_t batch = run_batch();
+        _exit(batch.bad != 0 || batch.rings != 0);
+    }
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+}
+#endif
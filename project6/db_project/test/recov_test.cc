@@ -0,0 +1,171 @@
+#include "bpt.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+ * Recovery from a crash after a checkpoint, the crash being a child process
+ * exiting without shutting the database down.
+ */
+class RecovTest : public ::testing::Test {
+    protected:
+    const char* pathname = "DATA7002";
+    const char* log_path = "recov_test_log.data";
+    const char* logmsg_path = "recov_test_msg.txt";
+    static const int num_keys = 3000;
+
+    // what the crashed process tells of its transactions
+    struct crash_result_t {
+        int winners[2];
+        int loser;
+        uint64_t redo_LSN;
+    };
+
+    int init() {
+        return init_db(64, 0, 0, (char*)log_path, (char*)logmsg_path, LRU_POLICY,
+                       BUFFER_PARTS, 0, 0, NULL);
+    }
+
+    /*
+     * Loads the table, commits an update of every third key before and after
+     * checkpointing, leaves a third update uncommitted with its records forced
+     * and exits.
+     */
+    void crash(int fd) {
+        crash_result_t result;
+        char value[50];
+        uint16_t old_size;
+        if (init() != 0) _exit(1);
+        int64_t table_id = open_table((char*)pathname);
+        memset(value, 'a', sizeof(value));
+        for (int key = 0; key < num_keys; key++)
+            db_insert(table_id, key, value, sizeof(value));
+
+        int trx_id = trx_begin();
+        for (int key = 0; key < num_keys; key += 3)
+            db_update(table_id, key, (char*)"CC", 2, &old_size, trx_id);
+        trx_commit(trx_id);
+        result.winners[0] = trx_id;
+        // frames are written back by the checkpoint after the one they were
+        // first dirty at, which takes the first winner out of redo
+        buffer_checkpoint();
+        result.redo_LSN = buffer_checkpoint();
+
+        trx_id = trx_begin();
+        for (int key = 2; key < num_keys; key += 3)
+            db_update(table_id, key, (char*)"DD", 2, &old_size, trx_id);
+        trx_commit(trx_id);
+        result.winners[1] = trx_id;
+
+        trx_id = trx_begin();
+        for (int key = 1; key < num_keys; key += 3)
+            db_update(table_id, key, (char*)"LL", 2, &old_size, trx_id);
+        result.loser = trx_id;
+        log_force();
+        if (write(fd, &result, sizeof(result)) != sizeof(result)) _exit(1);
+        _exit(0);
+    }
+
+    std::string analysis_line() {
+        std::ifstream logmsg(logmsg_path);
+        std::string line;
+        while (std::getline(logmsg, line)) {
+            if (line.rfind("[ANALYSIS] Analysis pass end", 0) == 0)
+                return line;
+        }
+        return "";
+    }
+
+    // Lines of the redo pass, each for one record.
+    std::vector<std::string> redo_lines() {
+        std::ifstream logmsg(logmsg_path);
+        std::vector<std::string> lines;
+        std::string line;
+        int in_redo = 0;
+        while (std::getline(logmsg, line)) {
+            if (line == "[REDO] Redo pass start.")
+                in_redo = 1;
+            else if (line == "[REDO] Redo pass end.")
+                break;
+            else if (in_redo)
+                lines.push_back(line);
+        }
+        return lines;
+    }
+
+    RecovTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(logmsg_path);
+    }
+
+    ~RecovTest() {
+        unlink(pathname);
+        unlink(log_path);
+        unlink(logmsg_path);
+    }
+};
+
+/*
+ * Redo starts from the checkpoint, yet both committed updates are there after
+ * recovery and the uncommitted one is undone.
+ */
+TEST_F(RecovTest, RecoversAfterCheckpoint) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        close(fds[0]);
+        crash(fds[1]);
+    }
+    close(fds[1]);
+    crash_result_t result;
+    ASSERT_EQ(read(fds[0], &result, sizeof(result)), (ssize_t)sizeof(result));
+    close(fds[0]);
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    EXPECT_NE(result.redo_LSN, 0UL);
+
+    ASSERT_EQ(init(), 0);
+    char expected[128];
+    sprintf(expected, "[ANALYSIS] Analysis pass end. Winner: %d %d, Loser: %d",
+            result.winners[0], result.winners[1], result.loser);
+    EXPECT_EQ(analysis_line(), std::string(expected));
+
+    // redo skips what the checkpoint wrote back, but not the later winner
+    int later_commit = 0;
+    for (const auto& line : redo_lines()) {
+        uint64_t LSN = strtoul(line.c_str() + 4, NULL, 10);
+        EXPECT_GE(LSN, result.redo_LSN) << line;
+        int trx_id;
+        if (sscanf(line.c_str(), "LSN %*u [COMMIT] Transaction id %d", &trx_id) == 1) {
+            EXPECT_NE(trx_id, result.winners[0]);
+            later_commit |= trx_id == result.winners[1];
+        }
+    }
+    EXPECT_TRUE(later_commit);
+
+    int64_t table_id = open_table((char*)pathname);
+    ASSERT_GT(table_id, 0);
+    int trx_id = trx_begin();
+    int bad = 0;
+    for (int key = 0; key < num_keys; key++) {
+        char value[128];
+        uint16_t size;
+        const char* prefix = key % 3 == 0 ? "CC" : key % 3 == 2 ? "DD" : "aa";
+        if (db_find(table_id, key, value, &size, trx_id) != 0 || size != 50 ||
+            memcmp(value, prefix, 2) != 0)
+            bad++;
+    }
+    trx_commit(trx_id);
+    EXPECT_EQ(bad, 0);
+    shutdown_db();
+}
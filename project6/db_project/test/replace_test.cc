@@ -0,0 +1,142 @@
+#include "buffer.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+// Victim order of each replacer, driven directly by frame index.
+
+static int any_frame(void*, int) {
+    return 1;
+}
+
+static int other_than(void* arg, int idx) {
+    return idx != *(int*)arg;
+}
+
+TEST(ReplacerTest, LruEvictsLeastRecentlyUsed) {
+    replacer_t* replacer = replacer_create(LRU_POLICY, 4);
+    for (int i = 0; i < 3; i++)
+        replacer->insert(i, 1, 10 + i);
+    replacer->touch(0);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 1);
+    delete replacer;
+}
+
+// The hand clears a reference bit and passes the frame over once.
+TEST(ReplacerTest, ClockGivesReferencedFrameSecondChance) {
+    replacer_t* replacer = replacer_create(CLOCK_POLICY, 3);
+    for (int i = 0; i < 3; i++)
+        replacer->insert(i, 1, 10 + i);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 0);
+    replacer->insert(0, 1, 13);
+    replacer->touch(1);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 2);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 1);
+    delete replacer;
+}
+
+/*
+ * A page evicted from A1in and read again while A1out remembers it goes to
+ * Am, which is passed over while A1in is above its share. A page only taken
+ * out of the queues, as for PRIORITY, is not remembered.
+ */
+TEST(ReplacerTest, TwoQPromotesPagesRememberedInA1out) {
+    replacer_t* replacer = replacer_create(TWO_Q_POLICY, 8);
+    for (int i = 0; i < 4; i++)
+        replacer->insert(i, 1, 10 + i);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 0);
+    replacer->insert(0, 1, 14);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 1);
+    replacer->insert(1, 1, 10);
+
+    replacer->insert(4, 1, 20);
+    replacer->remove(4);
+    replacer->insert(5, 1, 20);
+
+    int order[8];
+    int n = replacer->candidates(order, 8);
+    ASSERT_EQ(n, 5);
+    EXPECT_EQ(order[4], 1);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 2);
+    delete replacer;
+}
+
+// Frames with fewer than K references go first, then the oldest K-th reference.
+TEST(ReplacerTest, LruKEvictsFramesWithFewReferencesFirst) {
+    replacer_t* replacer = replacer_create(LRU_K_POLICY, 4);
+    replacer->insert(0, 1, 10);
+    replacer->touch(0);
+    replacer->insert(1, 1, 11);
+    replacer->touch(1);
+    replacer->insert(2, 1, 12);
+    EXPECT_EQ(replacer->victim(any_frame, NULL), 2);
+    int young = 2;
+    EXPECT_EQ(replacer->victim(other_than, &young), 0);
+    delete replacer;
+}
+
+// The history of an evicted page counts again when it is read back.
+TEST(ReplacerTest, LruKRetainsHistoryOfEvictedPages) {
+    replacer_t* replacer = replacer_create(LRU_K_POLICY, 4);
+    replacer->insert(0, 1, 10);
+    replacer->touch(0);
+    replacer->insert(0, 1, 11);
+    replacer->insert(1, 1, 10);
+    replacer->insert(2, 1, 12);
+
+    int order[4];
+    ASSERT_EQ(replacer->candidates(order, 4), 3);
+    EXPECT_EQ(order[0], 0);
+    EXPECT_EQ(order[1], 2);
+    EXPECT_EQ(order[2], 1);
+    delete replacer;
+}
+
+/*
+ * Hits and misses of a pass over pages that fit in the buffer, read twice,
+ * under every policy.
+ */
+class ReplaceHitTest : public ::testing::TestWithParam<int> {
+    protected:
+    const char* pathname = "DATA7004";
+    const char* log_path = "replace_test_log.data";
+
+    ReplaceHitTest() {
+        unlink(pathname);
+        unlink(log_path);
+    }
+
+    ~ReplaceHitTest() {
+        unlink(pathname);
+        unlink(log_path);
+    }
+};
+
+TEST_P(ReplaceHitTest, CountsHitsAndMisses) {
+    ASSERT_EQ(init_log((char*)log_path), 0);
+    int64_t table_id = file_open_table_file(pathname);
+    ASSERT_GT(table_id, 0);
+    ASSERT_EQ(init_buffer(256, GetParam(), 1), 0);
+    pagenum_t first = buffer_alloc_pages(table_id, 0, 100);
+    shutdown_buffer();
+
+    ASSERT_EQ(init_buffer(256, GetParam(), 1), 0);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < 100; i++) {
+            page_t* p;
+            buffer_read_page(table_id, first + i, &p, SHARED);
+            buffer_unpin_page(table_id, first + i);
+        }
+    }
+    uint64_t hits, misses;
+    buffer_get_hit_stats(&hits, &misses);
+    EXPECT_EQ(hits, 100UL);
+    EXPECT_EQ(misses, 100UL);
+    shutdown_buffer();
+    file_close_table_file();
+    shutdown_log();
+}
+
+INSTANTIATE_TEST_SUITE_P(Policies, ReplaceHitTest,
+                         ::testing::Values(LRU_POLICY, CLOCK_POLICY, TWO_Q_POLICY,
+                                           LRU_K_POLICY));